@@ -1,482 +1,3197 @@
-// Server.cpp - Custom HTTP Server
-#include <iostream>
-#include <fstream>
-#include <sstream>
-#include <string>
-#include <vector>
-#include <map>
-#include <ctime>
-#include <cstring>
-#include <cstdlib>
-#include <algorithm>
-
-#ifdef _WIN32
-    #define WIN32_LEAN_AND_MEAN
-    #include <windows.h>
-    #include <winsock2.h>
-    #include <ws2tcpip.h>
-    
-    #pragma comment(lib, "Ws2_32.lib")
-    #pragma comment(lib, "Mswsock.lib")
-    
-    #define close closesocket
-    #define read recv
-    #define write send
-    #define socklen_t int
-#else
-    #include <unistd.h>
-    #include <sys/socket.h>
-    #include <netinet/in.h>
-    #include <arpa/inet.h>
-    #include <netdb.h>
-    #include <errno.h>
-#endif
-
-using namespace std;
-
-// Configuration
-const int PORT = 8080;
-const int BUFFER_SIZE = 8192;
-const int MAX_CONNECTIONS = 10;
-const string SERVER_NAME = "MyHttpServer/1.0";
-
-// MIME types
-map<string, string> mime_types = {
-    {".html", "text/html; charset=utf-8"},
-    {".htm", "text/html; charset=utf-8"},
-    {".css", "text/css; charset=utf-8"},
-    {".js", "application/javascript; charset=utf-8"},
-    {".json", "application/json; charset=utf-8"},
-    {".png", "image/png"},
-    {".jpg", "image/jpeg"},
-    {".jpeg", "image/jpeg"},
-    {".gif", "image/gif"},
-    {".ico", "image/x-icon"},
-    {".txt", "text/plain; charset=utf-8"},
-    {".svg", "image/svg+xml"}
-};
-
-// Function declarations
-bool init_network();
-void cleanup_network();
-int create_server_socket();
-void handle_client(int client_socket);
-void handle_request(int client_socket, const string& request);
-string get_mime_type(const string& filename);
-string read_file(const string& filename);
-string url_decode(const string& encoded);
-void send_response(int client_socket, int status_code, 
-                   const string& content_type, const string& body);
-string generate_error_page(int status_code, const string& message);
-void log_message(const string& message);
-
-// Main function
-int main() {
-    cout << "==================================" << endl;
-    cout << "   Custom HTTP Server v1.0       " << endl;
-    cout << "==================================" << endl;
-    
-    // Initialize network
-    if (!init_network()) {
-        cerr << "Network initialization failed" << endl;
-        return 1;
-    }
-    
-    // Create server socket
-    int server_socket = create_server_socket();
-    if (server_socket < 0) {
-        cleanup_network();
-        return 1;
-    }
-    
-    // Server info
-    log_message("Server started on port " + to_string(PORT));
-    log_message("Open: http://localhost:" + to_string(PORT));
-    log_message("Press Ctrl+C to stop");
-    cout << endl;
-    
-    // Main server loop
-    try {
-        while (true) {
-            // Wait for client connection
-            struct sockaddr_in client_addr;
-            socklen_t client_len = sizeof(client_addr);
-            
-            log_message("Waiting for connection...");
-            
-            int client_socket = accept(server_socket, 
-                                      (struct sockaddr*)&client_addr,
-                                      &client_len);
-            
-            if (client_socket < 0) {
-                log_message("Accept failed");
-                continue;
-            }
-            
-            // Get client IP
-            char client_ip[INET_ADDRSTRLEN];
-            inet_ntop(AF_INET, &client_addr.sin_addr, client_ip, sizeof(client_ip));
-            log_message("Client connected: " + string(client_ip));
-            
-            // Handle client
-            handle_client(client_socket);
-        }
-    }
-    catch (const exception& e) {
-        log_message("Error: " + string(e.what()));
-    }
-    catch (...) {
-        log_message("Unknown error");
-    }
-    
-    // Cleanup
-    log_message("Shutting down...");
-    close(server_socket);
-    cleanup_network();
-    
-    log_message("Server stopped");
-    return 0;
-}
-
-// Network initialization
-bool init_network() {
-#ifdef _WIN32
-    WSADATA wsaData;
-    int result = WSAStartup(MAKEWORD(2, 2), &wsaData);
-    if (result != 0) {
-        log_message("WSAStartup failed: " + to_string(result));
-        return false;
-    }
-#endif
-    return true;
-}
-
-// Network cleanup
-void cleanup_network() {
-#ifdef _WIN32
-    WSACleanup();
-#endif
-}
-
-// Logging
-void log_message(const string& message) {
-    time_t now = time(nullptr);
-    char time_buf[80];
-    strftime(time_buf, sizeof(time_buf), "%Y-%m-%d %H:%M:%S", localtime(&now));
-    cout << "[" << time_buf << "] " << message << endl;
-}
-
-// Create server socket
-int create_server_socket() {
-    // Create socket
-    int server_socket = socket(AF_INET, SOCK_STREAM, 0);
-    if (server_socket < 0) {
-        log_message("Socket creation failed");
-        return -1;
-    }
-    
-    // Set socket options
-    int opt = 1;
-    setsockopt(server_socket, SOL_SOCKET, SO_REUSEADDR, 
-              (char*)&opt, sizeof(opt));
-    
-    // Bind address
-    struct sockaddr_in server_addr;
-    memset(&server_addr, 0, sizeof(server_addr));
-    server_addr.sin_family = AF_INET;
-    server_addr.sin_addr.s_addr = INADDR_ANY;
-    server_addr.sin_port = htons(PORT);
-    
-    if (bind(server_socket, (struct sockaddr*)&server_addr, sizeof(server_addr)) < 0) {
-        log_message("Bind failed on port " + to_string(PORT));
-        close(server_socket);
-        return -1;
-    }
-    
-    // Listen
-    if (listen(server_socket, MAX_CONNECTIONS) < 0) {
-        log_message("Listen failed");
-        close(server_socket);
-        return -1;
-    }
-    
-    return server_socket;
-}
-
-// Handle client connection
-void handle_client(int client_socket) {
-    // Set receive timeout
-#ifdef _WIN32
-    int timeout = 5000;
-    setsockopt(client_socket, SOL_SOCKET, SO_RCVTIMEO, 
-              (char*)&timeout, sizeof(timeout));
-#else
-    struct timeval timeout;
-    timeout.tv_sec = 5;
-    timeout.tv_usec = 0;
-    setsockopt(client_socket, SOL_SOCKET, SO_RCVTIMEO, 
-              &timeout, sizeof(timeout));
-#endif
-    
-    // Read request
-    char buffer[BUFFER_SIZE] = {0};
-    int bytes_received = recv(client_socket, buffer, sizeof(buffer) - 1, 0);
-    
-    if (bytes_received > 0) {
-        buffer[bytes_received] = '\0';
-        string request(buffer);
-        
-        // Log request line
-        size_t line_end = request.find("\r\n");
-        if (line_end != string::npos) {
-            log_message("Request: " + request.substr(0, line_end));
-        }
-        
-        // Handle request
-        handle_request(client_socket, request);
-    }
-    else if (bytes_received == 0) {
-        log_message("Client disconnected");
-    }
-    else {
-        log_message("Receive error");
-    }
-    
-    close(client_socket);
-}
-
-// Parse request line
-bool parse_request_line(const string& line, 
-                       string& method, 
-                       string& path) {
-    size_t space1 = line.find(' ');
-    if (space1 == string::npos) return false;
-    
-    size_t space2 = line.find(' ', space1 + 1);
-    if (space2 == string::npos) return false;
-    
-    method = line.substr(0, space1);
-    path = line.substr(space1 + 1, space2 - space1 - 1);
-    
-    return true;
-}
-
-// URL decode
-string url_decode(const string& encoded) {
-    string decoded;
-    
-    for (size_t i = 0; i < encoded.size(); ++i) {
-        if (encoded[i] == '%' && i + 2 < encoded.size()) {
-            string hex_str = encoded.substr(i + 1, 2);
-            int hex_value;
-            stringstream ss;
-            ss << hex << hex_str;
-            ss >> hex_value;
-            decoded += static_cast<char>(hex_value);
-            i += 2;
-        } 
-        else if (encoded[i] == '+') {
-            decoded += ' ';
-        }
-        else {
-            decoded += encoded[i];
-        }
-    }
-    
-    return decoded;
-}
-
-// Check path safety
-bool is_safe_path(const string& path) {
-    if (path.find("..") != string::npos) return false;
-    if (path.find("//") != string::npos) return false;
-    if (path.find('\\') != string::npos) return false;
-    return true;
-}
-
-// Get MIME type
-string get_mime_type(const string& filename) {
-    size_t dot_pos = filename.find_last_of('.');
-    if (dot_pos != string::npos) {
-        string ext = filename.substr(dot_pos);
-        string ext_lower = ext;
-        transform(ext_lower.begin(), ext_lower.end(), ext_lower.begin(), ::tolower);
-        
-        auto it = mime_types.find(ext_lower);
-        if (it != mime_types.end()) {
-            return it->second;
-        }
-    }
-    
-    return "application/octet-stream";
-}
-
-// Read file
-string read_file(const string& filename) {
-    ifstream file(filename, ios::binary | ios::ate);
-    if (!file) return "";
-    
-    streamsize size = file.tellg();
-    if (size <= 0) return "";
-    
-    file.seekg(0, ios::beg);
-    string content(size, '\0');
-    
-    if (!file.read(&content[0], size)) {
-        return "";
-    }
-    
-    return content;
-}
-
-// Get HTTP date
-string get_http_date() {
-    time_t now = time(nullptr);
-    char buf[100];
-    strftime(buf, sizeof(buf), "%a, %d %b %Y %H:%M:%S GMT", gmtime(&now));
-    return string(buf);
-}
-
-// Build response headers
-string build_response_headers(int status_code, 
-                             const string& status_text,
-                             const string& content_type,
-                             size_t content_length) {
-    stringstream headers;
-    
-    headers << "HTTP/1.1 " << status_code << " " << status_text << "\r\n";
-    headers << "Server: " << SERVER_NAME << "\r\n";
-    headers << "Date: " << get_http_date() << "\r\n";
-    headers << "Content-Type: " << content_type << "\r\n";
-    headers << "Content-Length: " << content_length << "\r\n";
-    headers << "Connection: close\r\n";
-    headers << "\r\n";
-    
-    return headers.str();
-}
-
-// Send response
-void send_response(int client_socket, 
-                  int status_code,
-                  const string& content_type,
-                  const string& body) {
-    
-    map<int, string> status_texts = {
-        {200, "OK"},
-        {400, "Bad Request"},
-        {403, "Forbidden"},
-        {404, "Not Found"},
-        {405, "Method Not Allowed"},
-        {500, "Internal Server Error"}
-    };
-    
-    string status_text = "Unknown";
-    if (status_texts.find(status_code) != status_texts.end()) {
-        status_text = status_texts[status_code];
-    }
-    
-    string headers = build_response_headers(status_code, status_text, 
-                                           content_type, body.length());
-    
-    send(client_socket, headers.c_str(), headers.length(), 0);
-    
-    if (!body.empty()) {
-        send(client_socket, body.c_str(), body.length(), 0);
-    }
-}
-
-// Generate error page
-string generate_error_page(int status_code, const string& message) {
-    stringstream html;
-    
-    html << "<!DOCTYPE html>"
-         << "<html>"
-         << "<head>"
-         << "<title>" << status_code << " " << message << "</title>"
-         << "<style>"
-         << "body { font-family: Arial, sans-serif; text-align: center; padding: 50px; }"
-         << "h1 { color: #333; }"
-         << "p { color: #666; }"
-         << ".container { max-width: 500px; margin: 0 auto; }"
-         << "</style>"
-         << "</head>"
-         << "<body>"
-         << "<div class='container'>"
-         << "<h1>" << status_code << " - " << message << "</h1>"
-         << "<p>Custom HTTP Server</p>"
-         << "</div>"
-         << "</body>"
-         << "</html>";
-    
-    return html.str();
-}
-
-// Handle HTTP request
-void handle_request(int client_socket, const string& request) {
-    // Find end of headers
-    size_t header_end = request.find("\r\n\r\n");
-    if (header_end == string::npos) {
-        string error_page = generate_error_page(400, "Bad Request");
-        send_response(client_socket, 400, "text/html", error_page);
-        return;
-    }
-    
-    string request_headers = request.substr(0, header_end);
-    
-    // Parse first line
-    size_t line_end = request_headers.find("\r\n");
-    if (line_end == string::npos) {
-        string error_page = generate_error_page(400, "Bad Request");
-        send_response(client_socket, 400, "text/html", error_page);
-        return;
-    }
-    
-    string request_line = request_headers.substr(0, line_end);
-    string method, path;
-    
-    if (!parse_request_line(request_line, method, path)) {
-        string error_page = generate_error_page(400, "Bad Request");
-        send_response(client_socket, 400, "text/html", error_page);
-        return;
-    }
-    
-    // Check method
-    if (method != "GET" && method != "HEAD") {
-        string error_page = generate_error_page(405, "Method Not Allowed");
-        send_response(client_socket, 405, "text/html", error_page);
-        return;
-    }
-    
-    // Check path safety
-    if (!is_safe_path(path)) {
-        string error_page = generate_error_page(403, "Forbidden");
-        send_response(client_socket, 403, "text/html", error_page);
-        return;
-    }
-    
-    // Normalize path
-    string filename = path;
-    if (filename.empty() || filename == "/") {
-        filename = "index.html";
-    } else if (filename[0] == '/') {
-        filename = filename.substr(1);
-    }
-    
-    // URL decode
-    filename = url_decode(filename);
-    
-    // Read file
-    string content = read_file(filename);
-    
-    if (content.empty()) {
-        string error_page = generate_error_page(404, "Not Found");
-        send_response(client_socket, 404, "text/html", error_page);
-        return;
-    }
-    
-    // Get MIME type and send response
-    string mime_type = get_mime_type(filename);
-    send_response(client_socket, 200, mime_type, content);
-    
-    log_message("Served: " + filename + " (" + to_string(content.length()) + " bytes)");
-}
\ No newline at end of file
+// Server.cpp - Custom HTTP Server
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <map>
+#include <list>
+#include <memory>
+#include <unordered_map>
+#include <ctime>
+#include <cstring>
+#include <cstdlib>
+#include <algorithm>
+#include <sys/stat.h>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+
+#ifdef _WIN32
+    #define WIN32_LEAN_AND_MEAN
+    #include <windows.h>
+    #include <winsock2.h>
+    #include <ws2tcpip.h>
+    
+    #pragma comment(lib, "Ws2_32.lib")
+    #pragma comment(lib, "Mswsock.lib")
+    
+    #define close closesocket
+    #define read recv
+    #define write send
+    #define socklen_t int
+#else
+    #include <unistd.h>
+    #include <sys/socket.h>
+    #include <netinet/in.h>
+    #include <arpa/inet.h>
+    #include <netdb.h>
+    #include <sys/uio.h>
+    #include <errno.h>
+    #include <csignal>
+#endif
+
+#ifdef __linux__
+    #include <sys/epoll.h>
+    #include <sys/inotify.h>
+    #include <sys/sendfile.h>
+    #include <sys/mman.h>
+    #include <netinet/tcp.h>
+    #include <fcntl.h>
+    #include <dirent.h>
+#endif
+
+// Vector delimiter scanning; build with -DNO_SIMD for the scalar path only
+#if !defined(NO_SIMD) && defined(__AVX2__)
+    #include <immintrin.h>
+    #define HAVE_AVX2 1
+#endif
+#if !defined(NO_SIMD) && (defined(__SSE2__) || defined(_M_X64))
+    #include <emmintrin.h>
+    #define HAVE_SSE2 1
+#endif
+#ifdef _MSC_VER
+    #include <intrin.h>
+#endif
+
+// io_uring engine, built by default where the kernel headers have it
+#if defined(__linux__) && !defined(NO_IO_URING) && __has_include(<linux/io_uring.h>)
+    #define HAVE_IO_URING 1
+    #include <linux/io_uring.h>
+    #include <sys/syscall.h>
+#endif
+
+// On-the-fly gzip of cached text files; build with -DWITH_ZLIB and -lz.
+// Without it, only precompressed .gz/.br siblings are served.
+#if defined(WITH_ZLIB) && __has_include(<zlib.h>)
+    #define HAVE_ZLIB 1
+    #include <zlib.h>
+#endif
+
+using namespace std;
+
+// Configuration
+const int PORT = 8080;
+const int BUFFER_SIZE = 8192;
+const int LISTEN_BACKLOG = 1024;
+const int MAX_EVENTS = 256;
+const int IDLE_TIMEOUT_SECONDS = 5;
+const int MAX_KEEP_ALIVE_REQUESTS = 100;
+const size_t MAX_PENDING_OUTPUT = 1024 * 1024;
+const size_t MAX_PENDING_CHUNKS = 64;
+const int MAX_IOVECS = 64;
+const size_t RESPONSE_HEAD_SIZE = 4096;
+const int MAX_RANGES = 16;
+const size_t SENDFILE_THRESHOLD = 256 * 1024;
+const size_t MAX_REQUEST_LINE = 8192;
+const size_t MAX_HEADER_SIZE = 16384;
+const int MAX_HEADER_COUNT = 100;
+const size_t FILE_CACHE_SIZE = 64 * 1024 * 1024;
+const size_t FILE_CACHE_MAX_ENTRY = 4 * 1024 * 1024;
+const int FILE_CACHE_SHARDS = 16;
+const size_t COMPRESS_MIN_SIZE = 256;
+const size_t WORKER_QUEUE_SIZE = 256;
+const unsigned URING_ENTRIES = 1024;
+const size_t LOG_RING_SIZE = 4096;             // Power of two
+const size_t LOG_RECORD_SIZE = 240;            // Longer messages are cut
+const int LOG_FLUSH_INTERVAL_MS = 10;
+const string SERVER_NAME = "MyHttpServer/1.0";
+
+// File types: MIME type and Cache-Control policy
+struct FileType {
+    string mime_type;
+    string cache_control;   // Empty = no Cache-Control header
+    bool compressible;      // Serve .br/.gz variants when the client accepts them
+};
+
+// MIME types
+map<string, FileType, less<>> mime_types = {
+    {".html", {"text/html; charset=utf-8", "no-cache", true}},
+    {".htm", {"text/html; charset=utf-8", "no-cache", true}},
+    {".css", {"text/css; charset=utf-8", "public, max-age=3600", true}},
+    {".js", {"application/javascript; charset=utf-8", "public, max-age=3600", true}},
+    {".json", {"application/json; charset=utf-8", "no-cache", true}},
+    {".png", {"image/png", "public, max-age=86400", false}},
+    {".jpg", {"image/jpeg", "public, max-age=86400", false}},
+    {".jpeg", {"image/jpeg", "public, max-age=86400", false}},
+    {".gif", {"image/gif", "public, max-age=86400", false}},
+    {".ico", {"image/x-icon", "public, max-age=86400", false}},
+    {".txt", {"text/plain; charset=utf-8", "no-cache", true}},
+    {".svg", {"image/svg+xml", "public, max-age=86400", true}}
+};
+
+// Content codings, in order of preference
+enum ContentEncoding {
+    ENCODING_BROTLI,
+    ENCODING_GZIP,
+    ENCODING_COUNT
+};
+
+struct EncodingInfo {
+    const char* name;       // Content-Encoding token
+    const char* suffix;     // Precompressed sibling file
+};
+
+const EncodingInfo encodings[ENCODING_COUNT] = {
+    {"br", ".br"},
+    {"gzip", ".gz"}
+};
+
+// Cache-Control by path prefix (added with --cache-control=PREFIX=VALUE);
+// checked before the extension, first match wins
+vector<pair<string, string>> cache_control_paths;
+
+// Cache-Control for fingerprinted names such as app.3f9a1c2e.js
+const string FINGERPRINT_CACHE_CONTROL = "public, max-age=31536000, immutable";
+
+// Server mode, chosen on the command line
+enum class ServerMode {
+    EventLoop,      // One thread multiplexing all connections
+    ThreadPool,     // Acceptor thread feeding a pool of workers
+    MultiAcceptor   // One SO_REUSEPORT listener and serve loop per thread
+};
+
+struct ServerOptions {
+    ServerMode mode = ServerMode::EventLoop;
+    unsigned workers = 0;                       // 0 = one per core
+    unsigned acceptors = 0;                     // 0 = one per core
+    size_t queue_size = WORKER_QUEUE_SIZE;
+    bool use_uring = false;                     // io_uring I/O engine
+    size_t max_header_size = MAX_HEADER_SIZE;   // Request line + headers
+    size_t cache_size = FILE_CACHE_SIZE;        // File cache budget, 0 = off
+    size_t sendfile_threshold = SENDFILE_THRESHOLD; // Larger files use sendfile()
+    bool use_mmap = false;                      // Map cached files, do not copy
+};
+
+ServerOptions options;
+
+// Headers the server looks up, indexed when the request is parsed
+enum class HeaderId : uint8_t {
+    Host,
+    Connection,
+    IfNoneMatch,
+    IfModifiedSince,
+    IfRange,
+    Range,
+    AcceptEncoding,
+    UserAgent,
+    Referer,
+    Count,
+    Unknown = Count
+};
+
+const int KNOWN_HEADER_COUNT = (int)HeaderId::Count;
+
+// Case-insensitive FNV-1a hash of a header name
+constexpr uint32_t header_hash(string_view name) {
+    uint32_t hash = 2166136261u;
+    for (char c : name) {
+        if (c >= 'A' && c <= 'Z') c = (char)(c - 'A' + 'a');
+        hash = (hash ^ (uint8_t)c) * 16777619u;
+    }
+    return hash;
+}
+
+// One header line, as views into the receive buffer
+struct HeaderField {
+    string_view name;
+    string_view value;
+};
+
+// Parsed request head. The views point into the connection's receive
+// buffer and stay valid until that buffer changes.
+struct ParsedRequest {
+    string_view request_line;
+    string_view method;
+    string_view target;
+    string_view version;
+    HeaderField headers[MAX_HEADER_COUNT];
+    int header_count = 0;
+    int8_t known_headers[KNOWN_HEADER_COUNT];  // Index into headers, or -1
+    
+    // Known header value by ID; empty if missing
+    string_view header(HeaderId id) const {
+        int index = known_headers[(int)id];
+        return index < 0 ? string_view() : headers[index].value;
+    }
+    
+    // Header value by case-insensitive name; empty if missing
+    string_view find_header(string_view name) const;
+};
+
+// Incremental parser for the request head (request line and headers).
+// Keeps its position between calls, so new data is scanned only once.
+// Records line positions as offsets, since the buffer may move as it grows.
+class RequestParser {
+public:
+    enum Result { Incomplete, Complete, Failed };
+    
+    // Continue parsing buffer from where the last call stopped
+    Result parse(const string& buffer);
+    // Split the completed head into views; false if a line is malformed
+    bool get_request(const string& buffer, ParsedRequest& request) const;
+    void reset();
+    
+    size_t head_start() const { return start; }     // After leading empty lines
+    size_t head_end() const { return pos; }         // Just past the blank line
+    int error_status() const { return error; }
+    
+private:
+    enum State {
+        SkipEmptyLines,
+        RequestLine,
+        HeaderLineStart,
+        HeaderLine,
+        LineFeed,
+        FinalLineFeed,
+        Done
+    };
+    
+    struct LineSpan {
+        uint32_t offset;
+        uint32_t length;
+        uint32_t colon;     // First ':' relative to offset, or NO_COLON
+    };
+    
+    static const uint32_t NO_COLON = 0xffffffff;
+    
+    Result fail(int status);
+    
+    State state = SkipEmptyLines;
+    size_t pos = 0;
+    size_t start = 0;
+    int line_count = 0;                         // Request line + headers
+    LineSpan lines[MAX_HEADER_COUNT + 1];
+    int error = 0;
+};
+
+// Open file descriptor, closed with its last reference
+struct FileDescriptor {
+    int fd;
+    
+    explicit FileDescriptor(int fd) : fd(fd) {}
+    ~FileDescriptor();
+    FileDescriptor(const FileDescriptor&) = delete;
+    FileDescriptor& operator=(const FileDescriptor&) = delete;
+};
+
+// Read-only file mapping, unmapped with its last reference
+struct MappedFile {
+    const char* data = nullptr;
+    size_t length = 0;
+    
+    MappedFile() = default;
+    ~MappedFile();
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+};
+
+// Pending response data: owned bytes, shared bytes kept alive by owner,
+// or a file range for sendfile()
+struct OutputChunk {
+    string data;
+    shared_ptr<const void> owner;
+    string_view view;
+    shared_ptr<FileDescriptor> file;
+    uint64_t file_offset = 0;
+    size_t file_length = 0;
+    size_t sent = 0;
+    
+    const char* bytes() const { return owner ? view.data() : data.data(); }
+    size_t size() const {
+        return file ? file_length : owner ? view.size() : data.size();
+    }
+};
+
+// Client connection state
+struct Connection {
+    int socket = -1;
+    string client_ip;
+    string in;              // Received bytes not yet handled
+    RequestParser parser;   // Progress through the next request in `in`
+    string path_buffer;     // Decoded request path, reused across requests
+    deque<OutputChunk> out; // Response data not yet sent, in request order
+    size_t out_memory = 0;  // Bytes of `out` held in memory
+    string spare;           // Buffer recycled from sent chunks
+    bool can_sendfile = false;  // Engine can send file chunks
+    bool close_after_write = false;
+    bool head_request = false;  // Responding to HEAD: headers only
+    int requests_served = 0;
+    time_t last_active = 0;
+};
+
+// Fixed-size pool of threads running handle_client()
+class WorkerPool {
+public:
+    WorkerPool(unsigned thread_count, size_t queue_capacity);
+    ~WorkerPool();
+    
+    // Queue a client socket; false when the queue is full
+    bool try_submit(int client_socket);
+    
+private:
+    void worker_loop();
+    
+    vector<thread> workers;
+    deque<int> queue;
+    size_t capacity;
+    bool stopping = false;
+    mutex queue_mutex;
+    condition_variable queue_ready;
+};
+
+// File contents with the response metadata computed once at load time
+struct CachedFile {
+    string filename;
+    string content;         // Empty when on_disk or mapped
+    string validator_headers;   // ETag, Last-Modified, Cache-Control and Vary lines
+    long max_age = -1;          // For Expires; -1 = none
+    string entity_headers;  // Content-Type, -Length and -Encoding, then validators
+    shared_ptr<MappedFile> mapping;     // Body in --mmap mode
+    size_t size = 0;
+    bool on_disk = false;   // Too large to hold; body is sent from the file
+    string mime_type;
+    string etag;            // Strong validator from size and content hash
+    string last_modified;   // HTTP date of the file's mtime
+    time_t mtime = 0;
+    const char* content_encoding = nullptr;     // Set on compressed variants
+    shared_ptr<const CachedFile> variants[ENCODING_COUNT];  // Compressed forms
+};
+
+// Shared LRU cache of file contents, keyed by normalized filename.
+// Sharded so threads rarely wait on each other; entries are handed out as
+// shared_ptr, so eviction never frees a file that a response is using.
+class FileCache {
+public:
+    void set_budget(size_t bytes);
+    
+    // Cached file, loading it on a miss; nullptr if it cannot be read
+    shared_ptr<const CachedFile> get(const string& filename);
+    void invalidate(const string& filename);
+    void clear();
+    
+private:
+    using LruList = list<shared_ptr<const CachedFile>>;
+    
+    struct Shard {
+        mutex shard_mutex;
+        LruList lru;                                    // Most recent first
+        unordered_map<string, LruList::iterator> index;
+        size_t used = 0;
+        uint64_t generation = 0;                        // Bumped on invalidation
+    };
+    
+    Shard& shard_for(const string& filename);
+    static size_t entry_size(const CachedFile& file);
+    void evict(Shard& shard);
+    
+    Shard shards[FILE_CACHE_SHARDS];
+    size_t shard_budget = 0;
+};
+
+FileCache file_cache;
+
+#ifdef __linux__
+// Watches the document root with inotify and drops cache entries for
+// files that change, so hits never need to stat()
+class FileWatcher {
+public:
+    bool start();
+    
+private:
+    void add_watches(const string& dir, const string& prefix);
+    void run();
+    
+    int inotify_fd = -1;
+    unordered_map<int, string> watch_prefixes;      // Watch -> path prefix
+};
+
+FileWatcher file_watcher;
+#endif
+
+// Log pipeline: threads push timestamped records into a lock-free ring
+// (bounded MPSC, a sequence number per slot) and one writer thread formats
+// and writes them in batches. A full ring drops the record and counts it;
+// pushing never blocks or allocates.
+class AsyncLog {
+public:
+    AsyncLog();
+    ~AsyncLog();
+    
+    void push(string_view message);
+    
+private:
+    struct Record {
+        atomic<size_t> sequence;    // == position when free, position + 1 when full
+        time_t time;
+        uint32_t length;
+        char text[LOG_RECORD_SIZE];
+    };
+    
+    void run();
+    void drain(string& batch);
+    
+    Record records[LOG_RING_SIZE];
+    alignas(64) atomic<size_t> enqueue_pos{0};
+    alignas(64) size_t dequeue_pos = 0;     // Writer thread only
+    atomic<uint64_t> dropped{0};
+    atomic<bool> stopping{false};
+    time_t stamp_time = -1;                 // Second that stamp was made for
+    char stamp[32];
+    thread writer;
+};
+
+AsyncLog async_log;
+
+// Function declarations
+bool parse_options(int argc, char* argv[]);
+bool init_network();
+void cleanup_network();
+int create_server_socket(bool reuse_port = false);
+void run_blocking_loop(int server_socket);
+void run_event_loop(int server_socket);
+void run_thread_pool_loop(int server_socket);
+void run_multi_acceptor(int server_socket);
+void run_server_loop(int server_socket);
+bool run_uring_loop(int server_socket);
+void handle_client(int client_socket);
+bool process_input(Connection& conn);
+void handle_request(Connection& conn, const ParsedRequest& request);
+bool flush_output(Connection& conn);
+void queue_output(Connection& conn, string_view data);
+void queue_file(Connection& conn, shared_ptr<FileDescriptor> file,
+                uint64_t offset, size_t length);
+void queue_shared(Connection& conn, shared_ptr<const void> owner, string_view view);
+void advance_output(Connection& conn, size_t bytes);
+#ifndef _WIN32
+int gather_output(const Connection& conn, struct iovec* iov, bool& file_follows);
+#endif
+bool would_block();
+const string& get_mime_type(string_view filename);
+const string& get_cache_control(string_view filename);
+long cache_max_age(string_view cache_control);
+string read_file(const string& filename);
+shared_ptr<CachedFile> load_file(const string& filename);
+shared_ptr<CachedFile> load_body(const string& filename, struct stat& st);
+shared_ptr<const CachedFile> select_variant(const shared_ptr<const CachedFile>& file,
+                                            string_view accept_encoding);
+shared_ptr<MappedFile> map_file(const string& filename, size_t size);
+string format_http_date(time_t time);
+bool parse_http_date(string_view text, time_t& result);
+bool is_not_modified(const ParsedRequest& request, const CachedFile& file);
+void url_decode(string_view encoded, string& decoded);
+bool equals_ignore_case(string_view a, string_view b);
+bool parse_request_line(string_view line, string_view& method,
+                        string_view& path, string_view& version);
+bool parse_header_line(string_view line, size_t colon,
+                       string_view& name, string_view& value);
+size_t scan_line(const char* data, size_t pos, size_t size, size_t& colon);
+HeaderId classify_header(string_view name);
+void send_response(Connection& conn, int status_code, 
+                   const string& content_type, const string& body);
+string generate_error_page(int status_code, const string& message);
+void log_message(const string& message);
+
+// Main function
+int main(int argc, char* argv[]) {
+    if (!parse_options(argc, argv)) {
+        return 1;
+    }
+    
+    cout << "==================================" << endl;
+    cout << "   Custom HTTP Server v1.0       " << endl;
+    cout << "==================================" << endl;
+    
+    // Initialize network
+    if (!init_network()) {
+        cerr << "Network initialization failed" << endl;
+        return 1;
+    }
+    
+    // Create server socket
+    bool reuse_port = options.mode == ServerMode::MultiAcceptor;
+    int server_socket = create_server_socket(reuse_port);
+    if (server_socket < 0) {
+        cleanup_network();
+        return 1;
+    }
+    
+#ifdef __linux__
+    // Keep cached files fresh when the document root changes
+    if (options.cache_size > 0) {
+        file_watcher.start();
+    }
+#endif
+    
+    // Server info
+    log_message("Server started on port " + to_string(PORT));
+    log_message("Open: http://localhost:" + to_string(PORT));
+    log_message("Press Ctrl+C to stop");
+    
+    // Main server loop
+    try {
+        if (options.mode == ServerMode::ThreadPool) {
+            run_thread_pool_loop(server_socket);
+        } else if (options.mode == ServerMode::MultiAcceptor) {
+            run_multi_acceptor(server_socket);
+        } else {
+            run_server_loop(server_socket);
+        }
+    }
+    catch (const exception& e) {
+        log_message("Error: " + string(e.what()));
+    }
+    catch (...) {
+        log_message("Unknown error");
+    }
+    
+    // Cleanup
+    log_message("Shutting down...");
+    close(server_socket);
+    cleanup_network();
+    
+    log_message("Server stopped");
+    return 0;
+}
+
+// Parse command line options
+bool parse_options(int argc, char* argv[]) {
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        
+        if (arg == "--workers") {
+            options.mode = ServerMode::ThreadPool;
+        } else if (arg.rfind("--workers=", 0) == 0) {
+            options.mode = ServerMode::ThreadPool;
+            options.workers = (unsigned)atoi(arg.c_str() + 10);
+        } else if (arg == "--acceptors") {
+            options.mode = ServerMode::MultiAcceptor;
+        } else if (arg.rfind("--acceptors=", 0) == 0) {
+            options.mode = ServerMode::MultiAcceptor;
+            options.acceptors = (unsigned)atoi(arg.c_str() + 12);
+        } else if (arg == "--uring") {
+            options.use_uring = true;
+        } else if (arg.rfind("--max-header-size=", 0) == 0) {
+            options.max_header_size = (size_t)atol(arg.c_str() + 18);
+        } else if (arg.rfind("--cache-size=", 0) == 0) {
+            options.cache_size = (size_t)atol(arg.c_str() + 13);
+        } else if (arg.rfind("--sendfile-threshold=", 0) == 0) {
+            options.sendfile_threshold = (size_t)atol(arg.c_str() + 21);
+        } else if (arg == "--mmap") {
+            options.use_mmap = true;
+        } else if (arg.rfind("--cache-control=", 0) == 0) {
+            // PREFIX=VALUE or .EXT=VALUE
+            string rule = arg.substr(16);
+            size_t equals = rule.find('=');
+            if (equals == string::npos || equals == 0) {
+                cerr << "Expected --cache-control=PREFIX=VALUE or .EXT=VALUE" << endl;
+                return false;
+            }
+            string match = rule.substr(0, equals);
+            string value = rule.substr(equals + 1);
+            
+            if (match[0] == '.') {
+                auto it = mime_types.find(match);
+                if (it == mime_types.end()) {
+                    mime_types[match] = FileType{"application/octet-stream", value, false};
+                } else {
+                    it->second.cache_control = value;
+                }
+            } else {
+                if (match[0] == '/') match.erase(0, 1);
+                cache_control_paths.emplace_back(match, value);
+            }
+        } else if (arg.rfind("--queue=", 0) == 0) {
+            options.queue_size = (size_t)atol(arg.c_str() + 8);
+        } else {
+            cerr << "Usage: " << argv[0] << " [--workers[=N]] [--queue=N] [--acceptors[=N]] [--uring]"
+                 << " [--max-header-size=N] [--cache-size=BYTES]"
+                 << " [--sendfile-threshold=BYTES] [--mmap]"
+                 << " [--cache-control=PREFIX|.EXT=VALUE]..." << endl;
+            return false;
+        }
+    }
+    
+    if (options.workers == 0) {
+        options.workers = max(1u, thread::hardware_concurrency());
+    }
+    if (options.acceptors == 0) {
+        options.acceptors = max(1u, thread::hardware_concurrency());
+    }
+    if (options.queue_size == 0) {
+        options.queue_size = 1;
+    }
+    
+    file_cache.set_budget(options.cache_size);
+    
+    return true;
+}
+
+// Network initialization
+bool init_network() {
+#ifdef _WIN32
+    WSADATA wsaData;
+    int result = WSAStartup(MAKEWORD(2, 2), &wsaData);
+    if (result != 0) {
+        log_message("WSAStartup failed: " + to_string(result));
+        return false;
+    }
+#else
+    // A client closing early must not kill the server on send()
+    signal(SIGPIPE, SIG_IGN);
+#endif
+    return true;
+}
+
+// Network cleanup
+void cleanup_network() {
+#ifdef _WIN32
+    WSACleanup();
+#endif
+}
+
+// Logging
+void log_message(const string& message) {
+    async_log.push(message);
+}
+
+AsyncLog::AsyncLog() {
+    for (size_t i = 0; i < LOG_RING_SIZE; ++i) {
+        records[i].sequence.store(i, memory_order_relaxed);
+    }
+    writer = thread(&AsyncLog::run, this);
+}
+
+// Stop the writer once everything pushed so far is written
+AsyncLog::~AsyncLog() {
+    stopping.store(true, memory_order_release);
+    if (writer.joinable()) writer.join();
+}
+
+void AsyncLog::push(string_view message) {
+    time_t now = time(nullptr);
+    size_t pos = enqueue_pos.load(memory_order_relaxed);
+    Record* record;
+    
+    // Claim a free slot
+    while (true) {
+        record = &records[pos & (LOG_RING_SIZE - 1)];
+        size_t sequence = record->sequence.load(memory_order_acquire);
+        intptr_t diff = (intptr_t)sequence - (intptr_t)pos;
+        if (diff == 0) {
+            if (enqueue_pos.compare_exchange_weak(pos, pos + 1, memory_order_relaxed)) break;
+        } else if (diff < 0) {
+            // Writer is a full lap behind
+            dropped.fetch_add(1, memory_order_relaxed);
+            return;
+        } else {
+            pos = enqueue_pos.load(memory_order_relaxed);
+        }
+    }
+    
+    record->time = now;
+    record->length = (uint32_t)min(message.size(), LOG_RECORD_SIZE);
+    memcpy(record->text, message.data(), record->length);
+    record->sequence.store(pos + 1, memory_order_release);
+}
+
+// Format every ready record into batch
+void AsyncLog::drain(string& batch) {
+    while (true) {
+        Record& record = records[dequeue_pos & (LOG_RING_SIZE - 1)];
+        if (record.sequence.load(memory_order_acquire) != dequeue_pos + 1) break;
+        
+        if (record.time != stamp_time) {
+            struct tm tm_buf;
+#ifdef _WIN32
+            localtime_s(&tm_buf, &record.time);
+#else
+            localtime_r(&record.time, &tm_buf);
+#endif
+            strftime(stamp, sizeof(stamp), "[%Y-%m-%d %H:%M:%S] ", &tm_buf);
+            stamp_time = record.time;
+        }
+        batch += stamp;
+        batch.append(record.text, record.length);
+        batch += '\n';
+        
+        record.sequence.store(dequeue_pos + LOG_RING_SIZE, memory_order_release);
+        dequeue_pos++;
+    }
+    
+    uint64_t lost = dropped.exchange(0, memory_order_relaxed);
+    if (lost > 0) {
+        batch += "[log] " + to_string(lost) + " records dropped, log ring full\n";
+    }
+}
+
+void AsyncLog::run() {
+    string batch;
+    
+    while (true) {
+        bool stop = stopping.load(memory_order_acquire);
+        
+        batch.clear();
+        drain(batch);
+        if (!batch.empty()) {
+            cout.write(batch.data(), (streamsize)batch.size());
+            cout.flush();
+        }
+        
+        if (stop) return;
+        if (batch.empty()) {
+            this_thread::sleep_for(chrono::milliseconds(LOG_FLUSH_INTERVAL_MS));
+        }
+    }
+}
+
+// Create server socket
+int create_server_socket(bool reuse_port) {
+    // Create socket
+    int server_socket = socket(AF_INET, SOCK_STREAM, 0);
+    if (server_socket < 0) {
+        log_message("Socket creation failed");
+        return -1;
+    }
+    
+    // Set socket options
+    int opt = 1;
+    setsockopt(server_socket, SOL_SOCKET, SO_REUSEADDR, 
+              (char*)&opt, sizeof(opt));
+    
+    // Let several sockets share the port; the kernel balances between them
+    if (reuse_port) {
+#ifdef SO_REUSEPORT
+        if (setsockopt(server_socket, SOL_SOCKET, SO_REUSEPORT, 
+                      (char*)&opt, sizeof(opt)) < 0) {
+            log_message("SO_REUSEPORT failed");
+            close(server_socket);
+            return -1;
+        }
+#else
+        log_message("SO_REUSEPORT not supported");
+        close(server_socket);
+        return -1;
+#endif
+    }
+    
+    // Bind address
+    struct sockaddr_in server_addr;
+    memset(&server_addr, 0, sizeof(server_addr));
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_addr.s_addr = INADDR_ANY;
+    server_addr.sin_port = htons(PORT);
+    
+    if (bind(server_socket, (struct sockaddr*)&server_addr, sizeof(server_addr)) < 0) {
+        log_message("Bind failed on port " + to_string(PORT));
+        close(server_socket);
+        return -1;
+    }
+    
+    // Listen
+    if (listen(server_socket, LISTEN_BACKLOG) < 0) {
+        log_message("Listen failed");
+        close(server_socket);
+        return -1;
+    }
+    
+    return server_socket;
+}
+
+// Blocking server loop: one client at a time
+void run_blocking_loop(int server_socket) {
+    while (true) {
+        // Wait for client connection
+        struct sockaddr_in client_addr;
+        socklen_t client_len = sizeof(client_addr);
+        
+        log_message("Waiting for connection...");
+        
+        int client_socket = accept(server_socket, 
+                                  (struct sockaddr*)&client_addr,
+                                  &client_len);
+        
+        if (client_socket < 0) {
+            log_message("Accept failed");
+            continue;
+        }
+        
+        // Get client IP
+        char client_ip[INET_ADDRSTRLEN];
+        inet_ntop(AF_INET, &client_addr.sin_addr, client_ip, sizeof(client_ip));
+        log_message("Client connected: " + string(client_ip));
+        
+        // Handle client
+        handle_client(client_socket);
+    }
+}
+
+// Handle client connection
+void handle_client(int client_socket) {
+    // Set receive timeout
+#ifdef _WIN32
+    int timeout = IDLE_TIMEOUT_SECONDS * 1000;
+    setsockopt(client_socket, SOL_SOCKET, SO_RCVTIMEO, 
+              (char*)&timeout, sizeof(timeout));
+#else
+    struct timeval timeout;
+    timeout.tv_sec = IDLE_TIMEOUT_SECONDS;
+    timeout.tv_usec = 0;
+    setsockopt(client_socket, SOL_SOCKET, SO_RCVTIMEO, 
+              &timeout, sizeof(timeout));
+#endif
+    
+    Connection conn;
+    conn.socket = client_socket;
+#ifdef __linux__
+    conn.can_sendfile = true;
+#endif
+    
+    // Serve requests until the client or a response closes the connection
+    char buffer[BUFFER_SIZE];
+    while (true) {
+        if (process_input(conn)) {
+            if (!flush_output(conn) || conn.close_after_write) break;
+            continue;
+        }
+        if (conn.close_after_write) break;
+        
+        int bytes_received = recv(client_socket, buffer, sizeof(buffer), 0);
+        
+        if (bytes_received > 0) {
+            conn.in.append(buffer, bytes_received);
+        }
+        else if (bytes_received == 0) {
+            log_message("Client disconnected");
+            break;
+        }
+        else {
+            log_message(conn.requests_served > 0 && would_block() ?
+                        "Client timed out" : "Receive error");
+            break;
+        }
+    }
+    
+    close(client_socket);
+}
+
+// Worker pool
+WorkerPool::WorkerPool(unsigned thread_count, size_t queue_capacity)
+    : capacity(queue_capacity) {
+    for (unsigned i = 0; i < thread_count; ++i) {
+        workers.emplace_back(&WorkerPool::worker_loop, this);
+    }
+}
+
+WorkerPool::~WorkerPool() {
+    {
+        lock_guard<mutex> lock(queue_mutex);
+        stopping = true;
+    }
+    queue_ready.notify_all();
+    
+    for (thread& worker : workers) {
+        worker.join();
+    }
+    for (int client_socket : queue) {
+        close(client_socket);
+    }
+}
+
+bool WorkerPool::try_submit(int client_socket) {
+    {
+        lock_guard<mutex> lock(queue_mutex);
+        if (queue.size() >= capacity) return false;
+        queue.push_back(client_socket);
+    }
+    queue_ready.notify_one();
+    return true;
+}
+
+void WorkerPool::worker_loop() {
+    while (true) {
+        int client_socket;
+        {
+            unique_lock<mutex> lock(queue_mutex);
+            queue_ready.wait(lock, [this] { return stopping || !queue.empty(); });
+            if (stopping) return;
+            
+            client_socket = queue.front();
+            queue.pop_front();
+        }
+        
+        try {
+            handle_client(client_socket);
+        }
+        catch (const exception& e) {
+            log_message("Worker error: " + string(e.what()));
+        }
+    }
+}
+
+// Reject a client when every worker is busy and the queue is full
+void reject_busy(int client_socket) {
+    Connection conn;
+    conn.socket = client_socket;
+    conn.close_after_write = true;
+    
+    string error_page = generate_error_page(503, "Service Unavailable");
+    send_response(conn, 503, "text/html", error_page);
+    flush_output(conn);
+    close(client_socket);
+}
+
+// Thread pool server loop: accept here, serve on the workers
+void run_thread_pool_loop(int server_socket) {
+    WorkerPool pool(options.workers, options.queue_size);
+    log_message("Worker pool: " + to_string(options.workers) + " threads, queue " +
+                to_string(options.queue_size));
+    
+    while (true) {
+        struct sockaddr_in client_addr;
+        socklen_t client_len = sizeof(client_addr);
+        
+        int client_socket = accept(server_socket, 
+                                  (struct sockaddr*)&client_addr,
+                                  &client_len);
+        
+        if (client_socket < 0) {
+            log_message("Accept failed");
+            continue;
+        }
+        
+        // Get client IP
+        char client_ip[INET_ADDRSTRLEN];
+        inet_ntop(AF_INET, &client_addr.sin_addr, client_ip, sizeof(client_ip));
+        log_message("Client connected: " + string(client_ip));
+        
+        if (!pool.try_submit(client_socket)) {
+            log_message("Server busy, rejected: " + string(client_ip));
+            reject_busy(client_socket);
+        }
+    }
+}
+
+// Serve loop for one listening socket
+void run_server_loop(int server_socket) {
+#ifdef HAVE_IO_URING
+    if (options.use_uring && run_uring_loop(server_socket)) return;
+#endif
+#ifdef __linux__
+    run_event_loop(server_socket);
+#else
+    run_blocking_loop(server_socket);
+#endif
+}
+
+// Multi-acceptor loop: one listener per thread, each with its own serve loop
+void run_multi_acceptor(int server_socket) {
+    vector<int> sockets = {server_socket};
+    
+    for (unsigned i = 1; i < options.acceptors; ++i) {
+        int extra_socket = create_server_socket(true);
+        if (extra_socket < 0) break;
+        sockets.push_back(extra_socket);
+    }
+    
+    log_message("Acceptors: " + to_string(sockets.size()) + " listeners");
+    
+    vector<thread> acceptors;
+    for (size_t i = 1; i < sockets.size(); ++i) {
+        acceptors.emplace_back([socket = sockets[i]] {
+            try {
+                run_server_loop(socket);
+            }
+            catch (const exception& e) {
+                log_message("Acceptor error: " + string(e.what()));
+            }
+            close(socket);
+        });
+    }
+    
+    run_server_loop(server_socket);
+    
+    for (thread& acceptor : acceptors) {
+        acceptor.join();
+    }
+}
+
+// Index of the lowest set bit
+inline int lowest_bit(uint32_t mask) {
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return (int)index;
+#else
+    return __builtin_ctz(mask);
+#endif
+}
+
+// Find the first '\r' or '\n' in data[pos, size), or size if there is none.
+// In the same pass, sets colon to the first ':' before it if colon is npos.
+size_t scan_line(const char* data, size_t pos, size_t size, size_t& colon) {
+#ifdef HAVE_AVX2
+    const __m256i cr32 = _mm256_set1_epi8('\r');
+    const __m256i lf32 = _mm256_set1_epi8('\n');
+    const __m256i colon32 = _mm256_set1_epi8(':');
+    
+    while (pos + 32 <= size) {
+        __m256i block = _mm256_loadu_si256((const __m256i*)(data + pos));
+        uint32_t eol = (uint32_t)_mm256_movemask_epi8(
+            _mm256_or_si256(_mm256_cmpeq_epi8(block, cr32), _mm256_cmpeq_epi8(block, lf32)));
+        uint32_t colons = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(block, colon32));
+        
+        if (eol) colons &= (eol - 1) & ~eol;    // Only colons before the line end
+        if (colon == string::npos && colons) colon = pos + lowest_bit(colons);
+        if (eol) return pos + lowest_bit(eol);
+        pos += 32;
+    }
+#endif
+#ifdef HAVE_SSE2
+    const __m128i cr16 = _mm_set1_epi8('\r');
+    const __m128i lf16 = _mm_set1_epi8('\n');
+    const __m128i colon16 = _mm_set1_epi8(':');
+    
+    while (pos + 16 <= size) {
+        __m128i block = _mm_loadu_si128((const __m128i*)(data + pos));
+        uint32_t eol = (uint32_t)_mm_movemask_epi8(
+            _mm_or_si128(_mm_cmpeq_epi8(block, cr16), _mm_cmpeq_epi8(block, lf16)));
+        uint32_t colons = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(block, colon16));
+        
+        if (eol) colons &= (eol - 1) & ~eol;
+        if (colon == string::npos && colons) colon = pos + lowest_bit(colons);
+        if (eol) return pos + lowest_bit(eol);
+        pos += 16;
+    }
+#endif
+    
+    // Scalar tail, or the whole scan without SIMD
+    for (; pos < size; ++pos) {
+        char c = data[pos];
+        if (c == '\r' || c == '\n') return pos;
+        if (c == ':' && colon == string::npos) colon = pos;
+    }
+    return size;
+}
+
+// Request parser
+RequestParser::Result RequestParser::fail(int status) {
+    error = status;
+    return Failed;
+}
+
+void RequestParser::reset() {
+    state = SkipEmptyLines;
+    pos = 0;
+    start = 0;
+    line_count = 0;
+    error = 0;
+}
+
+RequestParser::Result RequestParser::parse(const string& buffer) {
+    const char* data = buffer.data();
+    size_t size = buffer.size();
+    
+    while (pos < size && state != Done) {
+        char c = data[pos];
+        
+        switch (state) {
+        case SkipEmptyLines:
+            // Clients may send stray CRLFs between requests
+            if (c == '\r' || c == '\n') {
+                start = ++pos;
+            } else {
+                state = RequestLine;
+                lines[0].offset = (uint32_t)pos;
+                lines[0].colon = NO_COLON;
+            }
+            break;
+            
+        case RequestLine:
+        case HeaderLine: {
+            // Jump to the end of the line, noting the first ':' on the way
+            LineSpan& line = lines[line_count];
+            size_t colon = string::npos;
+            pos = scan_line(data, pos, size, colon);
+            if (line.colon == NO_COLON && colon != string::npos) {
+                line.colon = (uint32_t)(colon - line.offset);
+            }
+            
+            if (state == RequestLine && pos - start > MAX_REQUEST_LINE) return fail(414);
+            if (pos < size) {
+                if (data[pos] == '\n') return fail(400);
+                lines[line_count].length = (uint32_t)(pos - lines[line_count].offset);
+                ++line_count;
+                state = LineFeed;
+                ++pos;
+            }
+            break;
+        }
+            
+        case LineFeed:
+            if (c != '\n') return fail(400);
+            state = HeaderLineStart;
+            ++pos;
+            break;
+            
+        case HeaderLineStart:
+            if (c == '\r') {
+                state = FinalLineFeed;
+                ++pos;
+            } else {
+                if (line_count > MAX_HEADER_COUNT) return fail(431);
+                lines[line_count].offset = (uint32_t)pos;
+                lines[line_count].colon = NO_COLON;
+                state = HeaderLine;
+            }
+            break;
+            
+        case FinalLineFeed:
+            if (c != '\n') return fail(400);
+            state = Done;
+            ++pos;
+            break;
+            
+        case Done:
+            break;
+        }
+        
+        if (pos > options.max_header_size) return fail(431);
+    }
+    
+    return state == Done ? Complete : Incomplete;
+}
+
+bool RequestParser::get_request(const string& buffer, ParsedRequest& request) const {
+    string_view data(buffer);
+    
+    request.request_line = data.substr(lines[0].offset, lines[0].length);
+    if (!parse_request_line(request.request_line, request.method,
+                            request.target, request.version)) {
+        return false;
+    }
+    
+    request.header_count = 0;
+    memset(request.known_headers, -1, sizeof(request.known_headers));
+    
+    for (int i = 1; i < line_count; ++i) {
+        HeaderField& field = request.headers[request.header_count];
+        size_t colon = lines[i].colon == NO_COLON ? string_view::npos : lines[i].colon;
+        if (!parse_header_line(data.substr(lines[i].offset, lines[i].length), colon,
+                               field.name, field.value)) {
+            return false;
+        }
+        
+        // First occurrence wins
+        HeaderId id = classify_header(field.name);
+        if (id != HeaderId::Unknown && request.known_headers[(int)id] < 0) {
+            request.known_headers[(int)id] = (int8_t)request.header_count;
+        }
+        request.header_count++;
+    }
+    
+    return true;
+}
+
+string_view ParsedRequest::find_header(string_view name) const {
+    for (int i = 0; i < header_count; ++i) {
+        if (equals_ignore_case(headers[i].name, name)) return headers[i].value;
+    }
+    return string_view();
+}
+
+// Handle every complete request in the input buffer (pipelining),
+// appending responses in request order. Stops after a response that closes
+// the connection, or while MAX_PENDING_OUTPUT bytes wait to be sent.
+// Returns true if it queued any response.
+bool process_input(Connection& conn) {
+    bool handled = false;
+    
+    while (!conn.close_after_write &&
+           conn.out_memory < MAX_PENDING_OUTPUT &&
+           conn.out.size() < MAX_PENDING_CHUNKS) {
+        RequestParser::Result result = conn.parser.parse(conn.in);
+        if (result == RequestParser::Incomplete) break;
+        
+        if (result == RequestParser::Failed) {
+            int status = conn.parser.error_status();
+            string message = status == 414 ? "URI Too Long" :
+                             status == 431 ? "Request Header Fields Too Large" :
+                             "Bad Request";
+            log_message("Bad request: " + to_string(status));
+            
+            conn.close_after_write = true;
+            string error_page = generate_error_page(status, message);
+            send_response(conn, status, "text/html", error_page);
+            return true;
+        }
+        
+        ParsedRequest request;
+        if (!conn.parser.get_request(conn.in, request)) {
+            log_message("Bad request: 400");
+            
+            conn.close_after_write = true;
+            string error_page = generate_error_page(400, "Bad Request");
+            send_response(conn, 400, "text/html", error_page);
+            return true;
+        }
+        
+        // Log request line
+        log_message("Request: " + string(request.request_line));
+        
+        // HEAD gets the headers GET would, without the body
+        conn.head_request = request.method == "HEAD";
+        handle_request(conn, request);
+        conn.head_request = false;
+        handled = true;
+        
+        // Views into the buffer are dead from here on
+        conn.in.erase(0, conn.parser.head_end());
+        conn.parser.reset();
+    }
+    
+    return handled;
+}
+
+// Check whether the last socket call would have blocked
+bool would_block() {
+#ifdef _WIN32
+    return WSAGetLastError() == WSAEWOULDBLOCK;
+#else
+    return errno == EAGAIN || errno == EWOULDBLOCK;
+#endif
+}
+
+FileDescriptor::~FileDescriptor() {
+    if (fd >= 0) close(fd);
+}
+
+MappedFile::~MappedFile() {
+#ifdef __linux__
+    if (data != nullptr) munmap((void*)data, length);
+#endif
+}
+
+// Queue bytes, joining them to the last chunk when it holds owned bytes
+void queue_output(Connection& conn, string_view data) {
+    if (conn.out.empty() || conn.out.back().file || conn.out.back().owner) {
+        conn.out.emplace_back();
+        conn.out.back().data = move(conn.spare);
+        conn.spare = string();
+    }
+    conn.out.back().data.append(data.data(), data.size());
+    conn.out_memory += data.size();
+}
+
+// Queue a file range to be sent with sendfile()
+void queue_file(Connection& conn, shared_ptr<FileDescriptor> file,
+                uint64_t offset, size_t length) {
+    conn.out.emplace_back();
+    OutputChunk& chunk = conn.out.back();
+    chunk.file = move(file);
+    chunk.file_offset = offset;
+    chunk.file_length = length;
+}
+
+// Queue bytes owned elsewhere (a cached file or mapping) without copying
+void queue_shared(Connection& conn, shared_ptr<const void> owner, string_view view) {
+    conn.out.emplace_back();
+    OutputChunk& chunk = conn.out.back();
+    chunk.owner = move(owner);
+    chunk.view = view;
+}
+
+// Mark bytes from the front of the output as sent
+void advance_output(Connection& conn, size_t bytes) {
+    while (bytes > 0 && !conn.out.empty()) {
+        OutputChunk& chunk = conn.out.front();
+        size_t step = min(bytes, chunk.size() - chunk.sent);
+        chunk.sent += step;
+        bytes -= step;
+        
+        if (chunk.sent == chunk.size()) {
+            if (!chunk.file && !chunk.owner) {
+                conn.out_memory -= chunk.data.size();
+                
+                // Keep the buffer for the next response
+                if (chunk.data.capacity() > conn.spare.capacity()) {
+                    conn.spare = move(chunk.data);
+                    conn.spare.clear();
+                }
+            }
+            conn.out.pop_front();
+        }
+    }
+}
+
+#ifndef _WIN32
+// Point iov at the in-memory chunks at the front of the output, up to the
+// first file range; returns the count. file_follows is set if one is next.
+int gather_output(const Connection& conn, struct iovec* iov, bool& file_follows) {
+    int count = 0;
+    file_follows = false;
+    
+    for (const OutputChunk& chunk : conn.out) {
+        if (chunk.file) {
+            file_follows = true;
+            break;
+        }
+        if (count == MAX_IOVECS) break;
+        
+        iov[count].iov_base = (void*)(chunk.bytes() + chunk.sent);
+        iov[count].iov_len = chunk.size() - chunk.sent;
+        count++;
+    }
+    return count;
+}
+#endif
+
+// Send pending output; returns false if the connection failed.
+// Headers and bodies of queued responses go out in one sendmsg() each pass.
+bool flush_output(Connection& conn) {
+    while (!conn.out.empty()) {
+        OutputChunk& chunk = conn.out.front();
+        long sent;
+        
+#ifdef __linux__
+        if (chunk.file) {
+            off_t offset = (off_t)(chunk.file_offset + chunk.sent);
+            sent = sendfile(conn.socket, chunk.file->fd, &offset, chunk.size() - chunk.sent);
+            if (sent == 0) {
+                // The file shrank under us; the promised length cannot be sent
+                log_message("File truncated while sending");
+                return false;
+            }
+        } else
+#endif
+        {
+#ifdef _WIN32
+            sent = send(conn.socket, chunk.bytes() + chunk.sent,
+                        (int)(chunk.size() - chunk.sent), 0);
+#else
+            struct iovec iov[MAX_IOVECS];
+            bool file_follows;
+            
+            struct msghdr msg;
+            memset(&msg, 0, sizeof(msg));
+            msg.msg_iov = iov;
+            msg.msg_iovlen = gather_output(conn, iov, file_follows);
+            
+            // Hold back a partial segment when a file range follows (headers)
+            int flags = MSG_NOSIGNAL;
+#ifdef MSG_MORE
+            if (file_follows) flags |= MSG_MORE;
+#endif
+            sent = sendmsg(conn.socket, &msg, flags);
+#endif
+        }
+        
+        if (sent < 0) {
+            if (would_block()) return true;
+#ifdef __linux__
+            // The kernel reads mappings for us, so a shrunk file is EFAULT, not SIGBUS
+            if (errno == EFAULT) {
+                log_message("Mapped file truncated while sending");
+                return false;
+            }
+#endif
+            log_message("Send error");
+            return false;
+        }
+        advance_output(conn, (size_t)sent);
+    }
+    
+    return true;
+}
+
+#ifdef __linux__
+// Set socket non-blocking
+bool set_nonblocking(int socket) {
+    int flags = fcntl(socket, F_GETFL, 0);
+    if (flags < 0) return false;
+    return fcntl(socket, F_SETFL, flags | O_NONBLOCK) == 0;
+}
+
+// Accept all pending connections and register them with epoll
+void accept_connections(int server_socket, int epoll_fd,
+                        unordered_map<int, Connection>& connections) {
+    while (true) {
+        struct sockaddr_in client_addr;
+        socklen_t client_len = sizeof(client_addr);
+        
+        int client_socket = accept4(server_socket,
+                                    (struct sockaddr*)&client_addr,
+                                    &client_len, SOCK_NONBLOCK);
+        
+        if (client_socket < 0) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                log_message("Accept failed");
+            }
+            return;
+        }
+        
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        ev.data.fd = client_socket;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, client_socket, &ev) < 0) {
+            log_message("epoll_ctl failed");
+            close(client_socket);
+            continue;
+        }
+        
+        // Get client IP
+        char client_ip[INET_ADDRSTRLEN];
+        inet_ntop(AF_INET, &client_addr.sin_addr, client_ip, sizeof(client_ip));
+        log_message("Client connected: " + string(client_ip));
+        
+        Connection& conn = connections[client_socket];
+        conn = Connection();
+        conn.socket = client_socket;
+        conn.client_ip = client_ip;
+        conn.can_sendfile = true;
+        conn.last_active = time(nullptr);
+    }
+}
+
+// Read everything available; returns false if the connection is finished
+bool read_connection(Connection& conn) {
+    char buffer[BUFFER_SIZE];
+    
+    while (true) {
+        int bytes_received = recv(conn.socket, buffer, sizeof(buffer), 0);
+        
+        if (bytes_received > 0) {
+            conn.in.append(buffer, bytes_received);
+            continue;
+        }
+        if (bytes_received == 0) {
+            log_message("Client disconnected");
+            return false;
+        }
+        if (errno == EINTR) continue;
+        if (errno == EAGAIN || errno == EWOULDBLOCK) return true;
+        
+        log_message("Receive error");
+        return false;
+    }
+}
+
+// Event loop: non-blocking, edge-triggered epoll over all connections
+void run_event_loop(int server_socket) {
+    int epoll_fd = epoll_create1(0);
+    if (epoll_fd < 0 || !set_nonblocking(server_socket)) {
+        log_message("epoll setup failed, using blocking loop");
+        if (epoll_fd >= 0) close(epoll_fd);
+        run_blocking_loop(server_socket);
+        return;
+    }
+    
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN | EPOLLET;
+    ev.data.fd = server_socket;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, server_socket, &ev);
+    
+    unordered_map<int, Connection> connections;
+    vector<struct epoll_event> events(MAX_EVENTS);
+    time_t last_sweep = time(nullptr);
+    
+    auto close_connection = [&](int socket) {
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, socket, nullptr);
+        close(socket);
+        connections.erase(socket);
+    };
+    
+    while (true) {
+        int ready = epoll_wait(epoll_fd, events.data(), MAX_EVENTS, 1000);
+        if (ready < 0) {
+            if (errno == EINTR) continue;
+            log_message("epoll_wait failed");
+            break;
+        }
+        
+        time_t now = time(nullptr);
+        
+        for (int i = 0; i < ready; ++i) {
+            int fd = events[i].data.fd;
+            uint32_t flags = events[i].events;
+            
+            if (fd == server_socket) {
+                accept_connections(server_socket, epoll_fd, connections);
+                continue;
+            }
+            
+            auto it = connections.find(fd);
+            if (it == connections.end()) continue;
+            Connection& conn = it->second;
+            conn.last_active = now;
+            
+            if (flags & EPOLLERR) {
+                close_connection(fd);
+                continue;
+            }
+            
+            if (flags & (EPOLLIN | EPOLLRDHUP | EPOLLHUP)) {
+                if (!read_connection(conn)) {
+                    close_connection(fd);
+                    continue;
+                }
+            }
+            
+            // Answer pipelined requests while the socket takes the output
+            bool ok = flush_output(conn);
+            while (ok && process_input(conn)) {
+                ok = flush_output(conn);
+                if (!conn.out.empty()) break;
+            }
+            
+            if (!ok || (conn.close_after_write && conn.out.empty())) {
+                close_connection(fd);
+            }
+        }
+        
+        // Drop clients that stay silent too long
+        if (now != last_sweep) {
+            last_sweep = now;
+            vector<int> idle;
+            for (auto& entry : connections) {
+                if (now - entry.second.last_active >= IDLE_TIMEOUT_SECONDS) {
+                    idle.push_back(entry.first);
+                }
+            }
+            for (int socket : idle) {
+                log_message("Client timed out");
+                close_connection(socket);
+            }
+        }
+    }
+    
+    close(epoll_fd);
+}
+#endif
+
+#ifdef HAVE_IO_URING
+// Minimal io_uring wrapper over the raw system calls
+class IoUring {
+public:
+    ~IoUring();
+    
+    bool init(unsigned entries);
+    bool supports(const vector<int>& opcodes);
+    
+    // Next free submission entry, or nullptr when the ring is full
+    struct io_uring_sqe* get_sqe();
+    // Submit queued entries and wait for at least wait_for completions
+    int submit(unsigned wait_for);
+    
+    struct io_uring_cqe* peek_cqe();
+    void cqe_seen();
+    
+private:
+    int ring_fd = -1;
+    void* sq_ring = MAP_FAILED;
+    void* cq_ring = MAP_FAILED;
+    size_t sq_ring_size = 0;
+    size_t cq_ring_size = 0;
+    struct io_uring_sqe* sqes = (struct io_uring_sqe*)MAP_FAILED;
+    size_t sqes_size = 0;
+    
+    unsigned* sq_head = nullptr;
+    unsigned* sq_tail = nullptr;
+    unsigned* sq_mask = nullptr;
+    unsigned* sq_array = nullptr;
+    unsigned sq_entries = 0;
+    unsigned sqe_tail = 0;      // Local tail, published on submit
+    unsigned to_submit = 0;
+    
+    unsigned* cq_head = nullptr;
+    unsigned* cq_tail = nullptr;
+    unsigned* cq_mask = nullptr;
+    struct io_uring_cqe* cqes = nullptr;
+};
+
+IoUring::~IoUring() {
+    if (sqes != MAP_FAILED) munmap(sqes, sqes_size);
+    if (cq_ring != MAP_FAILED && cq_ring != sq_ring) munmap(cq_ring, cq_ring_size);
+    if (sq_ring != MAP_FAILED) munmap(sq_ring, sq_ring_size);
+    if (ring_fd >= 0) close(ring_fd);
+}
+
+bool IoUring::init(unsigned entries) {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    
+    ring_fd = (int)syscall(__NR_io_uring_setup, entries, &params);
+    if (ring_fd < 0) return false;
+    
+    sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        sq_ring_size = cq_ring_size = max(sq_ring_size, cq_ring_size);
+    }
+    
+    sq_ring = mmap(nullptr, sq_ring_size, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+    if (sq_ring == MAP_FAILED) return false;
+    
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        cq_ring = sq_ring;
+    } else {
+        cq_ring = mmap(nullptr, cq_ring_size, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_CQ_RING);
+        if (cq_ring == MAP_FAILED) return false;
+    }
+    
+    sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    sqes = (struct io_uring_sqe*)mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE,
+                                      MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED) return false;
+    
+    char* sq = (char*)sq_ring;
+    sq_head = (unsigned*)(sq + params.sq_off.head);
+    sq_tail = (unsigned*)(sq + params.sq_off.tail);
+    sq_mask = (unsigned*)(sq + params.sq_off.ring_mask);
+    sq_array = (unsigned*)(sq + params.sq_off.array);
+    sq_entries = params.sq_entries;
+    sqe_tail = *sq_tail;
+    
+    char* cq = (char*)cq_ring;
+    cq_head = (unsigned*)(cq + params.cq_off.head);
+    cq_tail = (unsigned*)(cq + params.cq_off.tail);
+    cq_mask = (unsigned*)(cq + params.cq_off.ring_mask);
+    cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+    
+    return true;
+}
+
+bool IoUring::supports(const vector<int>& opcodes) {
+    const unsigned op_count = 256;
+    vector<char> buffer(sizeof(struct io_uring_probe) +
+                        op_count * sizeof(struct io_uring_probe_op), 0);
+    struct io_uring_probe* probe = (struct io_uring_probe*)buffer.data();
+    
+    if (syscall(__NR_io_uring_register, ring_fd, IORING_REGISTER_PROBE,
+                probe, op_count) < 0) {
+        return false;
+    }
+    
+    for (int opcode : opcodes) {
+        if (opcode > probe->last_op) return false;
+        if (!(probe->ops[opcode].flags & IO_URING_OP_SUPPORTED)) return false;
+    }
+    return true;
+}
+
+struct io_uring_sqe* IoUring::get_sqe() {
+    unsigned head = __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+    if (sqe_tail - head >= sq_entries) return nullptr;
+    
+    unsigned index = sqe_tail & *sq_mask;
+    sq_array[index] = index;
+    ++sqe_tail;
+    ++to_submit;
+    
+    struct io_uring_sqe* sqe = &sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+int IoUring::submit(unsigned wait_for) {
+    __atomic_store_n(sq_tail, sqe_tail, __ATOMIC_RELEASE);
+    
+    unsigned flags = wait_for > 0 ? IORING_ENTER_GETEVENTS : 0;
+    int submitted = (int)syscall(__NR_io_uring_enter, ring_fd, to_submit,
+                                 wait_for, flags, nullptr, 0);
+    if (submitted < 0) return -errno;
+    
+    to_submit -= submitted;
+    return submitted;
+}
+
+struct io_uring_cqe* IoUring::peek_cqe() {
+    unsigned head = *cq_head;
+    if (head == __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE)) return nullptr;
+    return &cqes[head & *cq_mask];
+}
+
+void IoUring::cqe_seen() {
+    __atomic_store_n(cq_head, *cq_head + 1, __ATOMIC_RELEASE);
+}
+
+// Ring used by read_file() on io_uring threads
+thread_local IoUring* file_ring = nullptr;
+
+// Read a whole file with one read+close submission
+string uring_read_file(IoUring& ring, const string& filename) {
+    int fd = open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return "";
+    
+    struct stat st;
+    if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) || st.st_size <= 0) {
+        close(fd);
+        return "";
+    }
+    
+    string content(st.st_size, '\0');
+    
+    struct io_uring_sqe* read_sqe = ring.get_sqe();
+    read_sqe->opcode = IORING_OP_READ;
+    read_sqe->fd = fd;
+    read_sqe->addr = (uint64_t)(uintptr_t)&content[0];
+    read_sqe->len = (unsigned)content.size();
+    read_sqe->off = 0;
+    read_sqe->flags = IOSQE_IO_LINK;
+    read_sqe->user_data = 1;
+    
+    struct io_uring_sqe* close_sqe = ring.get_sqe();
+    close_sqe->opcode = IORING_OP_CLOSE;
+    close_sqe->fd = fd;
+    close_sqe->user_data = 2;
+    
+    int submitted;
+    do {
+        submitted = ring.submit(2);
+    } while (submitted == -EINTR);
+    
+    int read_result = -EIO;
+    bool closed = false;
+    for (int done = 0; done < 2 && submitted >= 0; ) {
+        struct io_uring_cqe* cqe = ring.peek_cqe();
+        if (cqe == nullptr) {
+            ring.submit(1);
+            continue;
+        }
+        if (cqe->user_data == 1) read_result = cqe->res;
+        if (cqe->user_data == 2) closed = cqe->res >= 0;
+        ring.cqe_seen();
+        ++done;
+    }
+    
+    if (!closed) close(fd);
+    if (read_result != (int)content.size()) return "";
+    
+    return content;
+}
+
+// Operations tracked in io_uring user data
+enum UringOp : uint64_t {
+    URING_ACCEPT = 1,
+    URING_RECV,
+    URING_SEND,
+    URING_CLOSE,
+    URING_TIMER
+};
+
+uint64_t uring_tag(UringOp op, int fd) {
+    return ((uint64_t)(uint32_t)fd << 32) | op;
+}
+
+// Connection plus the buffers a queued recv or sendmsg points at
+struct UringConnection {
+    Connection conn;
+    char buffer[BUFFER_SIZE];
+    struct msghdr msg;
+    struct iovec iov[MAX_IOVECS];
+};
+
+// Event loop on io_uring: accept, recv and send are completions on one ring
+bool run_uring_loop(int server_socket) {
+    IoUring ring;
+    IoUring file_reads;
+    
+    if (!ring.init(URING_ENTRIES) ||
+        !ring.supports({IORING_OP_ACCEPT, IORING_OP_RECV, IORING_OP_SENDMSG,
+                        IORING_OP_CLOSE, IORING_OP_TIMEOUT}) ||
+        !file_reads.init(4) ||
+        !file_reads.supports({IORING_OP_READ, IORING_OP_CLOSE})) {
+        log_message("io_uring unavailable, using default engine");
+        return false;
+    }
+    
+    log_message("I/O engine: io_uring");
+    file_ring = &file_reads;
+    
+    unordered_map<int, UringConnection> connections;
+    struct sockaddr_in client_addr;
+    socklen_t client_len = sizeof(client_addr);
+    struct __kernel_timespec tick = {1, 0};
+    
+    // Queue an entry, flushing the submission queue if it is full
+    auto next_sqe = [&ring]() {
+        struct io_uring_sqe* sqe = ring.get_sqe();
+        while (sqe == nullptr) {
+            ring.submit(0);
+            sqe = ring.get_sqe();
+        }
+        return sqe;
+    };
+    
+    auto queue_accept = [&]() {
+        client_len = sizeof(client_addr);
+        struct io_uring_sqe* sqe = next_sqe();
+        sqe->opcode = IORING_OP_ACCEPT;
+        sqe->fd = server_socket;
+        sqe->addr = (uint64_t)(uintptr_t)&client_addr;
+        sqe->addr2 = (uint64_t)(uintptr_t)&client_len;
+        sqe->user_data = uring_tag(URING_ACCEPT, server_socket);
+    };
+    
+    auto queue_recv = [&](UringConnection& uc) {
+        struct io_uring_sqe* sqe = next_sqe();
+        sqe->opcode = IORING_OP_RECV;
+        sqe->fd = uc.conn.socket;
+        sqe->addr = (uint64_t)(uintptr_t)uc.buffer;
+        sqe->len = sizeof(uc.buffer);
+        sqe->user_data = uring_tag(URING_RECV, uc.conn.socket);
+    };
+    
+    // Gather all queued responses into one sendmsg; connections here never
+    // queue file chunks (can_sendfile is off)
+    auto queue_send = [&](UringConnection& uc) {
+        bool file_follows;
+        memset(&uc.msg, 0, sizeof(uc.msg));
+        uc.msg.msg_iov = uc.iov;
+        uc.msg.msg_iovlen = gather_output(uc.conn, uc.iov, file_follows);
+        
+        struct io_uring_sqe* sqe = next_sqe();
+        sqe->opcode = IORING_OP_SENDMSG;
+        sqe->fd = uc.conn.socket;
+        sqe->addr = (uint64_t)(uintptr_t)&uc.msg;
+        sqe->len = 1;
+        sqe->msg_flags = MSG_NOSIGNAL;
+        sqe->user_data = uring_tag(URING_SEND, uc.conn.socket);
+    };
+    
+    auto queue_timer = [&]() {
+        struct io_uring_sqe* sqe = next_sqe();
+        sqe->opcode = IORING_OP_TIMEOUT;
+        sqe->fd = -1;
+        sqe->addr = (uint64_t)(uintptr_t)&tick;
+        sqe->len = 1;
+        sqe->user_data = uring_tag(URING_TIMER, -1);
+    };
+    
+    auto close_connection = [&](int socket) {
+        connections.erase(socket);
+        struct io_uring_sqe* sqe = next_sqe();
+        sqe->opcode = IORING_OP_CLOSE;
+        sqe->fd = socket;
+        sqe->user_data = uring_tag(URING_CLOSE, socket);
+    };
+    
+    // After a recv or completed send: send more, serve the next request,
+    // read more, or close
+    auto continue_connection = [&](UringConnection& uc) {
+        Connection& conn = uc.conn;
+        while (true) {
+            if (!conn.out.empty()) {
+                queue_send(uc);
+                return;
+            }
+            if (conn.close_after_write) {
+                close_connection(conn.socket);
+                return;
+            }
+            
+            if (!process_input(conn)) {
+                queue_recv(uc);
+                return;
+            }
+        }
+    };
+    
+    queue_accept();
+    queue_timer();
+    
+    while (true) {
+        int submitted = ring.submit(1);
+        if (submitted < 0 && submitted != -EINTR && submitted != -EBUSY) {
+            log_message("io_uring_enter failed");
+            break;
+        }
+        
+        time_t now = time(nullptr);
+        struct io_uring_cqe* cqe;
+        
+        while ((cqe = ring.peek_cqe()) != nullptr) {
+            UringOp op = (UringOp)(cqe->user_data & 0xffffffff);
+            int fd = (int)(cqe->user_data >> 32);
+            int result = cqe->res;
+            ring.cqe_seen();
+            
+            if (op == URING_ACCEPT) {
+                if (result >= 0) {
+                    char client_ip[INET_ADDRSTRLEN];
+                    inet_ntop(AF_INET, &client_addr.sin_addr, client_ip, sizeof(client_ip));
+                    log_message("Client connected: " + string(client_ip));
+                    
+                    UringConnection& uc = connections[result];
+                    uc.conn = Connection();
+                    uc.conn.socket = result;
+                    uc.conn.client_ip = client_ip;
+                    uc.conn.last_active = now;
+                    queue_recv(uc);
+                } else {
+                    log_message("Accept failed");
+                }
+                queue_accept();
+                continue;
+            }
+            
+            if (op == URING_TIMER) {
+                // Drop clients that stay silent too long; shutdown ends their recv
+                for (auto& entry : connections) {
+                    if (now - entry.second.conn.last_active >= IDLE_TIMEOUT_SECONDS) {
+                        log_message("Client timed out");
+                        shutdown(entry.first, SHUT_RDWR);
+                    }
+                }
+                queue_timer();
+                continue;
+            }
+            
+            if (op == URING_CLOSE) continue;
+            
+            auto it = connections.find(fd);
+            if (it == connections.end()) continue;
+            UringConnection& uc = it->second;
+            Connection& conn = uc.conn;
+            conn.last_active = now;
+            
+            if (op == URING_RECV) {
+                if (result > 0) {
+                    conn.in.append(uc.buffer, result);
+                    continue_connection(uc);
+                } else {
+                    log_message(result == 0 ? "Client disconnected" : "Receive error");
+                    close_connection(fd);
+                }
+            }
+            else if (op == URING_SEND) {
+                if (result >= 0) {
+                    advance_output(conn, (size_t)result);
+                    continue_connection(uc);
+                } else {
+                    log_message("Send error");
+                    close_connection(fd);
+                }
+            }
+        }
+    }
+    
+    file_ring = nullptr;
+    return true;
+}
+#endif
+
+// Compare ASCII strings ignoring case
+bool equals_ignore_case(string_view a, string_view b) {
+    if (a.size() != b.size()) return false;
+    for (size_t i = 0; i < a.size(); ++i) {
+        if (tolower((unsigned char)a[i]) != tolower((unsigned char)b[i])) return false;
+    }
+    return true;
+}
+
+// Trim spaces and tabs
+string_view trim(string_view text) {
+    size_t first = text.find_first_not_of(" \t");
+    if (first == string_view::npos) return string_view();
+    size_t last = text.find_last_not_of(" \t");
+    return text.substr(first, last - first + 1);
+}
+
+// Parse request line
+bool parse_request_line(string_view line, 
+                       string_view& method, 
+                       string_view& path,
+                       string_view& version) {
+    size_t space1 = line.find(' ');
+    if (space1 == string_view::npos) return false;
+    
+    size_t space2 = line.find(' ', space1 + 1);
+    if (space2 == string_view::npos) return false;
+    
+    method = line.substr(0, space1);
+    path = line.substr(space1 + 1, space2 - space1 - 1);
+    version = line.substr(space2 + 1);
+    
+    return !method.empty() && !path.empty() && version.substr(0, 5) == "HTTP/";
+}
+
+// Parse "Name: value" given the colon position from scan_line();
+// no whitespace is allowed before the colon
+bool parse_header_line(string_view line, size_t colon,
+                       string_view& name, string_view& value) {
+    if (colon == string_view::npos || colon == 0) return false;
+    
+    name = line.substr(0, colon);
+    if (name.back() == ' ' || name.back() == '\t') return false;
+    
+    value = trim(line.substr(colon + 1));
+    return true;
+}
+
+// Map a header name to its ID by hash, confirming the name on a match
+HeaderId classify_header(string_view name) {
+    HeaderId id;
+    string_view expected;
+    
+    switch (header_hash(name)) {
+    case header_hash("host"):
+        id = HeaderId::Host; expected = "host"; break;
+    case header_hash("connection"):
+        id = HeaderId::Connection; expected = "connection"; break;
+    case header_hash("if-none-match"):
+        id = HeaderId::IfNoneMatch; expected = "if-none-match"; break;
+    case header_hash("if-modified-since"):
+        id = HeaderId::IfModifiedSince; expected = "if-modified-since"; break;
+    case header_hash("if-range"):
+        id = HeaderId::IfRange; expected = "if-range"; break;
+    case header_hash("range"):
+        id = HeaderId::Range; expected = "range"; break;
+    case header_hash("accept-encoding"):
+        id = HeaderId::AcceptEncoding; expected = "accept-encoding"; break;
+    case header_hash("user-agent"):
+        id = HeaderId::UserAgent; expected = "user-agent"; break;
+    case header_hash("referer"):
+        id = HeaderId::Referer; expected = "referer"; break;
+    default:
+        return HeaderId::Unknown;
+    }
+    
+    return equals_ignore_case(name, expected) ? id : HeaderId::Unknown;
+}
+
+// Check for a token in a comma-separated header value (case-insensitive)
+bool header_has_token(string_view value, string_view token) {
+    while (!value.empty()) {
+        size_t comma = value.find(',');
+        if (equals_ignore_case(trim(value.substr(0, comma)), token)) return true;
+        if (comma == string_view::npos) break;
+        value.remove_prefix(comma + 1);
+    }
+    return false;
+}
+
+// Hex digit value, or -1
+int hex_value(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+// URL decode into a reused buffer
+void url_decode(string_view encoded, string& decoded) {
+    decoded.clear();
+    
+    for (size_t i = 0; i < encoded.size(); ++i) {
+        if (encoded[i] == '%' && i + 2 < encoded.size() &&
+            hex_value(encoded[i + 1]) >= 0 && hex_value(encoded[i + 2]) >= 0) {
+            decoded += static_cast<char>(hex_value(encoded[i + 1]) * 16 +
+                                         hex_value(encoded[i + 2]));
+            i += 2;
+        } 
+        else if (encoded[i] == '+') {
+            decoded += ' ';
+        }
+        else {
+            decoded += encoded[i];
+        }
+    }
+}
+
+// Check path safety
+bool is_safe_path(string_view path) {
+    if (path.find("..") != string_view::npos) return false;
+    if (path.find("//") != string_view::npos) return false;
+    if (path.find('\\') != string_view::npos) return false;
+    if (path.find('\0') != string_view::npos) return false;
+    // "." segments would give one file several names (and cache entries)
+    if (path.substr(0, 2) == "./" || path.find("/./") != string_view::npos) return false;
+    if (path == "." || (path.size() >= 2 && path.substr(path.size() - 2) == "/.")) return false;
+    return true;
+}
+
+// Find the file type for a filename's extension; nullptr if unknown
+const FileType* find_file_type(string_view filename) {
+    size_t dot_pos = filename.find_last_of('.');
+    if (dot_pos != string_view::npos && filename.size() - dot_pos < 16) {
+        char ext_lower[16];
+        size_t length = filename.size() - dot_pos;
+        for (size_t i = 0; i < length; ++i) {
+            ext_lower[i] = (char)tolower((unsigned char)filename[dot_pos + i]);
+        }
+        
+        auto it = mime_types.find(string_view(ext_lower, length));
+        if (it != mime_types.end()) {
+            return &it->second;
+        }
+    }
+    
+    return nullptr;
+}
+
+// Get MIME type
+const string& get_mime_type(string_view filename) {
+    static const string default_type = "application/octet-stream";
+    
+    const FileType* type = find_file_type(filename);
+    return type != nullptr ? type->mime_type : default_type;
+}
+
+// Check for a content hash segment in the name, as in app.3f9a1c2e.js
+bool is_fingerprinted(string_view filename) {
+    size_t slash = filename.find_last_of('/');
+    if (slash != string_view::npos) filename.remove_prefix(slash + 1);
+    
+    size_t start = filename.find('.');
+    while (start != string_view::npos) {
+        size_t end = filename.find('.', start + 1);
+        if (end == string_view::npos) break;     // Last segment is the extension
+        
+        string_view segment = filename.substr(start + 1, end - start - 1);
+        if (segment.size() >= 8 &&
+            all_of(segment.begin(), segment.end(),
+                   [](char c) { return hex_value(c) >= 0; })) {
+            return true;
+        }
+        start = end;
+    }
+    return false;
+}
+
+// Get Cache-Control policy: path prefix, then fingerprint, then extension
+const string& get_cache_control(string_view filename) {
+    static const string none;
+    
+    for (const auto& rule : cache_control_paths) {
+        if (filename.substr(0, rule.first.size()) == rule.first) return rule.second;
+    }
+    
+    if (is_fingerprinted(filename)) return FINGERPRINT_CACHE_CONTROL;
+    
+    const FileType* type = find_file_type(filename);
+    return type != nullptr ? type->cache_control : none;
+}
+
+// max-age from a Cache-Control value; -1 if absent
+long cache_max_age(string_view cache_control) {
+    size_t pos = cache_control.find("max-age=");
+    if (pos == string_view::npos) return -1;
+    return atol(string(cache_control.substr(pos + 8)).c_str());
+}
+
+// Read file
+string read_file(const string& filename) {
+#ifdef HAVE_IO_URING
+    if (file_ring != nullptr) return uring_read_file(*file_ring, filename);
+#endif
+    
+    ifstream file(filename, ios::binary | ios::ate);
+    if (!file) return "";
+    
+    streamsize size = file.tellg();
+    if (size <= 0) return "";
+    
+    file.seekg(0, ios::beg);
+    string content(size, '\0');
+    
+    if (!file.read(&content[0], size)) {
+        return "";
+    }
+    
+    return content;
+}
+
+// Load a file's bytes (or mapping) and strong validator; nullptr if
+// missing or empty. Files at or above the sendfile threshold keep only
+// their metadata.
+shared_ptr<CachedFile> load_body(const string& filename, struct stat& st) {
+    if (stat(filename.c_str(), &st) != 0) return nullptr;
+    if (!S_ISREG(st.st_mode) || st.st_size <= 0) return nullptr;
+    
+    auto file = make_shared<CachedFile>();
+    char etag[64];
+    
+    bool large = (size_t)st.st_size >= options.sendfile_threshold;
+    if (!large && options.use_mmap) {
+        file->mapping = map_file(filename, (size_t)st.st_size);
+        if (!file->mapping) return nullptr;
+    }
+    
+    if (large || file->mapping) {
+        // Validator from size, mtime and inode; never touch mapped bytes here,
+        // a concurrent truncate would turn that into SIGBUS
+        file->on_disk = large;
+        file->size = (size_t)st.st_size;
+        snprintf(etag, sizeof(etag), "\"%zx-%llx-%llx\"", file->size,
+                 (unsigned long long)st.st_mtime, (unsigned long long)st.st_ino);
+    } else {
+        file->content = read_file(filename);
+        if (file->content.empty()) return nullptr;
+        file->size = file->content.size();
+        
+        // FNV-1a over the contents
+        uint64_t hash = 14695981039346656037ull;
+        for (char c : file->content) {
+            hash = (hash ^ (uint8_t)c) * 1099511628211ull;
+        }
+        snprintf(etag, sizeof(etag), "\"%zx-%016llx\"",
+                 file->size, (unsigned long long)hash);
+    }
+    
+    file->filename = filename;
+    file->etag = etag;
+    file->mtime = st.st_mtime;
+    file->last_modified = format_http_date(st.st_mtime);
+    return file;
+}
+
+// Precompute the header blocks of a loaded file
+void build_file_headers(CachedFile& file, const string& cache_control, bool vary) {
+    file.validator_headers = "ETag: " + file.etag + "\r\n" +
+                             "Last-Modified: " + file.last_modified + "\r\n";
+    if (!cache_control.empty()) {
+        file.validator_headers += "Cache-Control: " + cache_control + "\r\n";
+        file.max_age = cache_max_age(cache_control);
+    }
+    if (vary) {
+        file.validator_headers += "Vary: Accept-Encoding\r\n";
+    }
+    
+    file.entity_headers = "Content-Type: " + file.mime_type + "\r\n" +
+                          "Content-Length: " + to_string(file.size) + "\r\n";
+    if (file.content_encoding != nullptr) {
+        file.entity_headers += string("Content-Encoding: ") + file.content_encoding + "\r\n";
+    }
+    file.entity_headers += "Accept-Ranges: bytes\r\n" + file.validator_headers;
+}
+
+#ifdef HAVE_ZLIB
+// Gzip an in-memory file; nullptr if it does not get meaningfully smaller
+shared_ptr<CachedFile> gzip_file(const CachedFile& file) {
+    z_stream stream = {};
+    // 15 + 16: gzip wrapper rather than raw zlib
+    if (deflateInit2(&stream, Z_BEST_COMPRESSION, Z_DEFLATED, 15 + 16, 8,
+                     Z_DEFAULT_STRATEGY) != Z_OK) {
+        return nullptr;
+    }
+    
+    string compressed(deflateBound(&stream, file.content.size()), '\0');
+    stream.next_in = (Bytef*)file.content.data();
+    stream.avail_in = (uInt)file.content.size();
+    stream.next_out = (Bytef*)&compressed[0];
+    stream.avail_out = (uInt)compressed.size();
+    int result = deflate(&stream, Z_FINISH);
+    compressed.resize(stream.total_out);
+    deflateEnd(&stream);
+    
+    if (result != Z_STREAM_END || compressed.size() > file.size - file.size / 8) {
+        return nullptr;
+    }
+    
+    auto variant = make_shared<CachedFile>();
+    variant->filename = file.filename;
+    variant->content = move(compressed);
+    variant->size = variant->content.size();
+    variant->mtime = file.mtime;
+    variant->last_modified = file.last_modified;
+    // Same bytes in, same bytes out: derive the validator from the original
+    variant->etag = file.etag.substr(0, file.etag.size() - 1) + "-gzip\"";
+    return variant;
+}
+#endif
+
+// Load a file with its response metadata; nullptr if missing or empty.
+// Compressible types also pick up precompressed .br/.gz siblings that are
+// at least as new as the file, or a gzip made here when built with zlib.
+shared_ptr<CachedFile> load_file(const string& filename) {
+    struct stat st;
+    shared_ptr<CachedFile> file = load_body(filename, st);
+    if (!file) return nullptr;
+    
+    file->mime_type = get_mime_type(filename);
+    const string& cache_control = get_cache_control(filename);
+    const FileType* type = find_file_type(filename);
+    bool has_variants = false;
+    
+    if (type != nullptr && type->compressible) {
+        shared_ptr<CachedFile> variants[ENCODING_COUNT];
+        for (int i = 0; i < ENCODING_COUNT; ++i) {
+            struct stat variant_st;
+            variants[i] = load_body(filename + encodings[i].suffix, variant_st);
+            if (variants[i] && variant_st.st_mtime < st.st_mtime) variants[i] = nullptr;
+        }
+        
+#ifdef HAVE_ZLIB
+        if (!variants[ENCODING_GZIP] && !file->content.empty() &&
+            file->size >= COMPRESS_MIN_SIZE) {
+            variants[ENCODING_GZIP] = gzip_file(*file);
+        }
+#endif
+        
+        for (int i = 0; i < ENCODING_COUNT; ++i) {
+            if (!variants[i]) continue;
+            variants[i]->mime_type = file->mime_type;
+            variants[i]->content_encoding = encodings[i].name;
+            build_file_headers(*variants[i], cache_control, true);
+            file->variants[i] = move(variants[i]);
+            has_variants = true;
+        }
+    }
+    
+    build_file_headers(*file, cache_control, has_variants);
+    return file;
+}
+
+// Choose the variant of a file to send for an Accept-Encoding value.
+// A coding is acceptable when listed (or matched by "*") without q=0.
+shared_ptr<const CachedFile> select_variant(const shared_ptr<const CachedFile>& file,
+                                            string_view accept_encoding) {
+    if (accept_encoding.empty()) return file;
+    
+    bool accepted[ENCODING_COUNT] = {};
+    bool listed[ENCODING_COUNT] = {};
+    bool wildcard = false;
+    
+    while (!accept_encoding.empty()) {
+        size_t comma = accept_encoding.find(',');
+        string_view item = accept_encoding.substr(0, comma);
+        accept_encoding.remove_prefix(comma == string_view::npos ?
+                                      accept_encoding.size() : comma + 1);
+        
+        size_t semicolon = item.find(';');
+        string_view coding = trim(item.substr(0, semicolon));
+        bool allowed = true;
+        if (semicolon != string_view::npos) {
+            // q=0, q=0.0, q=0.000: not acceptable
+            string_view params = trim(item.substr(semicolon + 1));
+            if (params.size() >= 3 && (params[0] == 'q' || params[0] == 'Q') &&
+                params[1] == '=') {
+                string_view q = params.substr(2);
+                allowed = q.find_first_not_of("0.") != string_view::npos;
+            }
+        }
+        
+        if (coding == "*") {
+            wildcard = allowed;
+            continue;
+        }
+        for (int i = 0; i < ENCODING_COUNT; ++i) {
+            if (equals_ignore_case(coding, encodings[i].name)) {
+                listed[i] = true;
+                accepted[i] = allowed;
+            }
+        }
+    }
+    
+    for (int i = 0; i < ENCODING_COUNT; ++i) {
+        if (file->variants[i] && (accepted[i] || (wildcard && !listed[i]))) {
+            return file->variants[i];
+        }
+    }
+    return file;
+}
+
+// Map a file read-only; nullptr where mmap is unavailable or fails
+shared_ptr<MappedFile> map_file(const string& filename, size_t size) {
+#ifdef __linux__
+    int fd = open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return nullptr;
+    
+    void* data = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) return nullptr;
+    
+    madvise(data, size, MADV_SEQUENTIAL);
+    
+    auto mapping = make_shared<MappedFile>();
+    mapping->data = (const char*)data;
+    mapping->length = size;
+    return mapping;
+#else
+    (void)filename;
+    (void)size;
+    return nullptr;
+#endif
+}
+
+// File cache
+void FileCache::set_budget(size_t bytes) {
+    shard_budget = bytes / FILE_CACHE_SHARDS;
+}
+
+FileCache::Shard& FileCache::shard_for(const string& filename) {
+    return shards[hash<string>()(filename) % FILE_CACHE_SHARDS];
+}
+
+size_t FileCache::entry_size(const CachedFile& file) {
+    size_t size = sizeof(CachedFile) + file.filename.size() + file.content.size() +
+                  file.mime_type.size() + file.etag.size() + file.last_modified.size();
+    for (const auto& variant : file.variants) {
+        if (variant) size += entry_size(*variant);
+    }
+    return size;
+}
+
+shared_ptr<const CachedFile> FileCache::get(const string& filename) {
+    Shard& shard = shard_for(filename);
+    uint64_t generation;
+    
+    {
+        lock_guard<mutex> lock(shard.shard_mutex);
+        auto it = shard.index.find(filename);
+        if (it != shard.index.end()) {
+            shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+            return *it->second;
+        }
+        generation = shard.generation;
+    }
+    
+    // Miss: read the file without holding the lock
+    shared_ptr<const CachedFile> file = load_file(filename);
+    if (!file) return nullptr;
+    
+    size_t size = entry_size(*file);
+    if (size > shard_budget || (!file->on_disk && file->size > FILE_CACHE_MAX_ENTRY)) {
+        return file;
+    }
+    
+    lock_guard<mutex> lock(shard.shard_mutex);
+    auto it = shard.index.find(filename);
+    if (it != shard.index.end()) {
+        // Another thread loaded it first
+        return *it->second;
+    }
+    if (shard.generation != generation) {
+        // Invalidated while loading; what we read may already be stale
+        return file;
+    }
+    
+    shard.lru.push_front(file);
+    shard.index[filename] = shard.lru.begin();
+    shard.used += size;
+    evict(shard);
+    
+    return file;
+}
+
+void FileCache::evict(Shard& shard) {
+    while (shard.used > shard_budget && !shard.lru.empty()) {
+        const shared_ptr<const CachedFile>& oldest = shard.lru.back();
+        shard.used -= entry_size(*oldest);
+        shard.index.erase(oldest->filename);
+        shard.lru.pop_back();
+    }
+}
+
+void FileCache::invalidate(const string& filename) {
+    Shard& shard = shard_for(filename);
+    lock_guard<mutex> lock(shard.shard_mutex);
+    shard.generation++;
+    
+    auto it = shard.index.find(filename);
+    if (it == shard.index.end()) return;
+    
+    shard.used -= entry_size(**it->second);
+    shard.lru.erase(it->second);
+    shard.index.erase(it);
+}
+
+void FileCache::clear() {
+    for (Shard& shard : shards) {
+        lock_guard<mutex> lock(shard.shard_mutex);
+        shard.generation++;
+        shard.lru.clear();
+        shard.index.clear();
+        shard.used = 0;
+    }
+}
+
+#ifdef __linux__
+// File watcher
+const uint32_t WATCH_EVENTS = IN_MODIFY | IN_CLOSE_WRITE | IN_ATTRIB | IN_CREATE |
+                              IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF;
+
+bool FileWatcher::start() {
+    inotify_fd = inotify_init1(IN_CLOEXEC);
+    if (inotify_fd < 0) {
+        log_message("inotify unavailable, cached files will not refresh");
+        return false;
+    }
+    
+    add_watches(".", "");
+    log_message("Watching " + to_string(watch_prefixes.size()) + " directories for changes");
+    
+    thread(&FileWatcher::run, this).detach();
+    return true;
+}
+
+// Watch a directory and everything below it
+void FileWatcher::add_watches(const string& dir, const string& prefix) {
+    int watch = inotify_add_watch(inotify_fd, dir.c_str(), WATCH_EVENTS | IN_ONLYDIR);
+    if (watch < 0) {
+        log_message("Cannot watch directory: " + dir);
+        return;
+    }
+    watch_prefixes[watch] = prefix;
+    
+    DIR* handle = opendir(dir.c_str());
+    if (handle == nullptr) return;
+    
+    while (struct dirent* entry = readdir(handle)) {
+        string name = entry->d_name;
+        if (name == "." || name == "..") continue;
+        
+        string path = dir + "/" + name;
+        struct stat st;
+        if (lstat(path.c_str(), &st) == 0 && S_ISDIR(st.st_mode)) {
+            add_watches(path, prefix + name + "/");
+        }
+    }
+    closedir(handle);
+}
+
+void FileWatcher::run() {
+    alignas(struct inotify_event) char buffer[16384];
+    
+    while (true) {
+        ssize_t length = read(inotify_fd, buffer, sizeof(buffer));
+        if (length < 0) {
+            if (errno == EINTR) continue;
+            log_message("inotify read failed, clearing file cache");
+            file_cache.clear();
+            return;
+        }
+        
+        for (char* ptr = buffer; ptr < buffer + length; ) {
+            struct inotify_event* event = (struct inotify_event*)ptr;
+            ptr += sizeof(struct inotify_event) + event->len;
+            
+            if (event->mask & IN_Q_OVERFLOW) {
+                // Events were lost; nothing in the cache can be trusted
+                file_cache.clear();
+                continue;
+            }
+            
+            auto it = watch_prefixes.find(event->wd);
+            if (it == watch_prefixes.end()) continue;
+            
+            if (event->mask & IN_IGNORED) {
+                watch_prefixes.erase(it);
+                continue;
+            }
+            if (event->len == 0) continue;
+            
+            string path = it->second + event->name;
+            
+            if (event->mask & IN_ISDIR) {
+                if (event->mask & (IN_CREATE | IN_MOVED_TO)) {
+                    add_watches("./" + path, path + "/");
+                }
+                if (event->mask & (IN_DELETE | IN_MOVED_FROM)) {
+                    // Everything below it is gone or renamed
+                    file_cache.clear();
+                }
+                continue;
+            }
+            
+            file_cache.invalidate(path);
+            
+            // A precompressed sibling is cached with the file it belongs to
+            for (const EncodingInfo& encoding : encodings) {
+                size_t suffix = strlen(encoding.suffix);
+                if (path.size() > suffix &&
+                    path.compare(path.size() - suffix, suffix, encoding.suffix) == 0) {
+                    file_cache.invalidate(path.substr(0, path.size() - suffix));
+                }
+            }
+        }
+    }
+}
+#endif
+
+// Format a time as an HTTP date
+string format_http_date(time_t time) {
+    struct tm tm_buf;
+#ifdef _WIN32
+    gmtime_s(&tm_buf, &time);
+#else
+    gmtime_r(&time, &tm_buf);
+#endif
+    char buf[100];
+    strftime(buf, sizeof(buf), "%a, %d %b %Y %H:%M:%S GMT", &tm_buf);
+    return string(buf);
+}
+
+// Parse an IMF-fixdate ("Sun, 06 Nov 1994 08:49:37 GMT")
+bool parse_http_date(string_view text, time_t& result) {
+    static const char months[] = "JanFebMarAprMayJunJulAugSepOctNovDec";
+    
+    if (text.size() != 29 || text[3] != ',' || text.substr(25) != " GMT") return false;
+    
+    auto number = [&text](size_t pos, size_t count, int& value) {
+        value = 0;
+        for (size_t i = pos; i < pos + count; ++i) {
+            if (text[i] < '0' || text[i] > '9') return false;
+            value = value * 10 + (text[i] - '0');
+        }
+        return true;
+    };
+    
+    int day, year, hour, minute, second;
+    if (!number(5, 2, day) || !number(12, 4, year) || !number(17, 2, hour) ||
+        !number(20, 2, minute) || !number(23, 2, second)) {
+        return false;
+    }
+    
+    const char* month_pos = strstr(months, string(text.substr(8, 3)).c_str());
+    if (month_pos == nullptr || (month_pos - months) % 3 != 0) return false;
+    int month = (int)(month_pos - months) / 3 + 1;
+    
+    // Days since the epoch for a proleptic Gregorian date
+    int y = year - (month <= 2 ? 1 : 0);
+    int era = (y >= 0 ? y : y - 399) / 400;
+    int year_of_era = y - era * 400;
+    int day_of_year = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+    int day_of_era = year_of_era * 365 + year_of_era / 4 - year_of_era / 100 + day_of_year;
+    long long days = (long long)era * 146097 + day_of_era - 719468;
+    
+    result = (time_t)(days * 86400 + hour * 3600 + minute * 60 + second);
+    return true;
+}
+
+// Check If-None-Match, or else If-Modified-Since, against the file
+bool is_not_modified(const ParsedRequest& request, const CachedFile& file) {
+    string_view if_none_match = request.header(HeaderId::IfNoneMatch);
+    if (!if_none_match.empty()) {
+        // Weak comparison, as required for If-None-Match
+        while (!if_none_match.empty()) {
+            size_t comma = if_none_match.find(',');
+            string_view tag = trim(if_none_match.substr(0, comma));
+            if (tag.substr(0, 2) == "W/") tag.remove_prefix(2);
+            if (tag == "*" || tag == file.etag) return true;
+            if (comma == string_view::npos) break;
+            if_none_match.remove_prefix(comma + 1);
+        }
+        return false;
+    }
+    
+    string_view if_modified_since = request.header(HeaderId::IfModifiedSince);
+    if (if_modified_since.empty()) return false;
+    if (if_modified_since == file.last_modified) return true;
+    
+    time_t since;
+    return parse_http_date(if_modified_since, since) && file.mtime <= since;
+}
+
+// Response head assembled by memcpy into a fixed buffer
+struct ResponseHead {
+    char data[RESPONSE_HEAD_SIZE];
+    size_t length = 0;
+    
+    void append(string_view text) {
+        size_t count = min(text.size(), sizeof(data) - length);
+        memcpy(data + length, text.data(), count);
+        length += count;
+    }
+    
+    void append_number(size_t value) {
+        char digits[24];
+        size_t count = 0;
+        do {
+            digits[sizeof(digits) - ++count] = (char)('0' + value % 10);
+            value /= 10;
+        } while (value > 0);
+        append(string_view(digits + sizeof(digits) - count, count));
+    }
+    
+    string_view view() const { return string_view(data, length); }
+};
+
+// Precomputed status line and Server header
+string_view status_line(int status_code) {
+    static const map<int, string> lines = [] {
+        map<int, string> status_texts = {
+            {200, "OK"},
+            {206, "Partial Content"},
+            {304, "Not Modified"},
+            {400, "Bad Request"},
+            {403, "Forbidden"},
+            {404, "Not Found"},
+            {405, "Method Not Allowed"},
+            {414, "URI Too Long"},
+            {416, "Range Not Satisfiable"},
+            {431, "Request Header Fields Too Large"},
+            {500, "Internal Server Error"},
+            {503, "Service Unavailable"}
+        };
+        
+        map<int, string> result;
+        for (const auto& entry : status_texts) {
+            result[entry.first] = "HTTP/1.1 " + to_string(entry.first) + " " +
+                                  entry.second + "\r\nServer: " + SERVER_NAME + "\r\n";
+        }
+        return result;
+    }();
+    
+    auto it = lines.find(status_code);
+    return it != lines.end() ? string_view(it->second) : string_view(lines.at(500));
+}
+
+// Date header line, formatted at most once per second per thread
+string_view date_header() {
+    thread_local time_t cached_second = -1;
+    thread_local char line[64];
+    thread_local size_t length = 0;
+    
+    time_t now = time(nullptr);
+    if (now != cached_second) {
+        cached_second = now;
+        string date = format_http_date(now);
+        length = (size_t)snprintf(line, sizeof(line), "Date: %s\r\n", date.c_str());
+    }
+    return string_view(line, length);
+}
+
+// Build response headers
+void build_response_headers(ResponseHead& head,
+                            int status_code,
+                            string_view entity_headers,
+                            bool keep_alive,
+                            int requests_left) {
+    head.append(status_line(status_code));
+    head.append(date_header());
+    head.append(entity_headers);
+    if (keep_alive) {
+        static const string keep_alive_prefix = "Connection: keep-alive\r\nKeep-Alive: timeout=" +
+                                                to_string(IDLE_TIMEOUT_SECONDS) + ", max=";
+        head.append(keep_alive_prefix);
+        head.append_number((size_t)requests_left);
+        head.append("\r\n");
+    } else {
+        head.append("Connection: close\r\n");
+    }
+    head.append("\r\n");
+}
+
+// Queue response headers
+void send_headers(Connection& conn,
+                  int status_code,
+                  string_view entity_headers) {
+    ResponseHead head;
+    build_response_headers(head, status_code, entity_headers,
+                           !conn.close_after_write,
+                           MAX_KEEP_ALIVE_REQUESTS - conn.requests_served);
+    queue_output(conn, head.view());
+}
+
+// Queue headers for a file response: its precomputed lines, plus
+// Expires when its policy has a max-age
+void send_file_headers(Connection& conn, int status_code, string_view file_headers,
+                       long max_age) {
+    if (max_age < 0) {
+        send_headers(conn, status_code, file_headers);
+        return;
+    }
+    
+    // Expires moves with the clock; format it once per second per thread
+    thread_local time_t cached_second = -1;
+    thread_local long cached_max_age = -1;
+    thread_local string expires;
+    
+    time_t now = time(nullptr);
+    if (now != cached_second || max_age != cached_max_age) {
+        cached_second = now;
+        cached_max_age = max_age;
+        expires = "Expires: " + format_http_date(now + max_age) + "\r\n";
+    }
+    
+    ResponseHead entity;
+    entity.append(file_headers);
+    entity.append(expires);
+    send_headers(conn, status_code, entity.view());
+}
+
+// Queue response headers for a body of the given type and length
+void send_headers(Connection& conn,
+                  int status_code,
+                  string_view content_type,
+                  size_t content_length) {
+    ResponseHead entity;
+    entity.append("Content-Type: ");
+    entity.append(content_type);
+    entity.append("\r\nContent-Length: ");
+    entity.append_number(content_length);
+    entity.append("\r\n");
+    
+    send_headers(conn, status_code, entity.view());
+}
+
+// Send response
+void send_response(Connection& conn, 
+                  int status_code,
+                  const string& content_type,
+                  const string& body) {
+    send_headers(conn, status_code, content_type, body.length());
+    if (!conn.head_request) queue_output(conn, body);
+}
+
+// Where a response body comes from: shared memory, or a file for sendfile()
+struct FileBody {
+    shared_ptr<const void> owner;
+    string_view data;
+    shared_ptr<FileDescriptor> file;
+};
+
+// Find the body of a file: the cache entry, its mapping, or for files too
+// large to cache, the file itself (sendfile() where the engine can,
+// otherwise a plain read)
+bool open_file_body(Connection& conn, const shared_ptr<const CachedFile>& file,
+                    FileBody& body) {
+    if (file->mapping) {
+        body.owner = file->mapping;
+        body.data = string_view(file->mapping->data, file->mapping->length);
+        return true;
+    }
+    if (!file->on_disk) {
+        body.owner = file;
+        body.data = file->content;
+        return true;
+    }
+    
+#ifdef __linux__
+    if (conn.can_sendfile) {
+        int fd = open(file->filename.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) return false;
+        body.file = make_shared<FileDescriptor>(fd);
+        return true;
+    }
+#else
+    (void)conn;
+#endif
+    
+    auto content = make_shared<string>(read_file(file->filename));
+    if (content->size() != file->size) return false;
+    body.data = *content;
+    body.owner = move(content);
+    return true;
+}
+
+// Queue length bytes of a body starting at offset
+void queue_body(Connection& conn, const FileBody& body, uint64_t offset, size_t length) {
+    if (body.file) {
+        queue_file(conn, body.file, offset, length);
+    } else {
+        queue_shared(conn, body.owner, body.data.substr((size_t)offset, length));
+    }
+}
+
+// Inclusive byte range
+struct ByteRange {
+    uint64_t first;
+    uint64_t last;
+};
+
+enum class RangeResult { Ignore, Satisfiable, Unsatisfiable };
+
+// Parse "bytes=a-b, c-, -n" against a file size. Malformed headers and
+// more than MAX_RANGES ranges are ignored (full response), as RFC 7233 allows.
+RangeResult parse_range(string_view header, uint64_t size, ByteRange* ranges, int& count) {
+    count = 0;
+    header = trim(header);
+    if (header.substr(0, 6) != "bytes=") return RangeResult::Ignore;
+    header.remove_prefix(6);
+    
+    auto parse_number = [](string_view text, uint64_t& value) {
+        if (text.empty() || text.size() > 18) return false;
+        value = 0;
+        for (char c : text) {
+            if (c < '0' || c > '9') return false;
+            value = value * 10 + (uint64_t)(c - '0');
+        }
+        return true;
+    };
+    
+    bool any_spec = false;
+    while (!header.empty()) {
+        size_t comma = header.find(',');
+        string_view spec = trim(header.substr(0, comma));
+        header.remove_prefix(comma == string_view::npos ? header.size() : comma + 1);
+        if (spec.empty()) continue;
+        
+        size_t dash = spec.find('-');
+        if (dash == string_view::npos) return RangeResult::Ignore;
+        string_view first_text = spec.substr(0, dash);
+        string_view last_text = spec.substr(dash + 1);
+        any_spec = true;
+        
+        ByteRange range;
+        if (first_text.empty()) {
+            // Suffix: the last n bytes
+            uint64_t suffix;
+            if (!parse_number(last_text, suffix)) return RangeResult::Ignore;
+            if (suffix == 0 || size == 0) continue;
+            range.first = suffix >= size ? 0 : size - suffix;
+            range.last = size - 1;
+        } else {
+            if (!parse_number(first_text, range.first)) return RangeResult::Ignore;
+            if (last_text.empty()) {
+                range.last = size - 1;
+            } else {
+                if (!parse_number(last_text, range.last)) return RangeResult::Ignore;
+                if (range.last < range.first) return RangeResult::Ignore;
+                range.last = min(range.last, size - 1);
+            }
+            if (range.first >= size) continue;
+        }
+        
+        if (count == MAX_RANGES) return RangeResult::Ignore;
+        ranges[count++] = range;
+    }
+    
+    if (!any_spec) return RangeResult::Ignore;
+    return count > 0 ? RangeResult::Satisfiable : RangeResult::Unsatisfiable;
+}
+
+// If-Range: the range applies only if the validator still matches
+bool if_range_matches(const ParsedRequest& request, const CachedFile& file) {
+    string_view if_range = request.header(HeaderId::IfRange);
+    if (if_range.empty()) return true;
+    if (if_range.substr(0, 2) == "W/") return false;     // Strong comparison only
+    if (if_range[0] == '"') return if_range == file.etag;
+    return if_range == file.last_modified;
+}
+
+// Boundary for multipart/byteranges bodies
+const string& byteranges_boundary() {
+    static const string boundary = [] {
+        char buf[40];
+        snprintf(buf, sizeof(buf), "diet-%016llx",
+                 (unsigned long long)time(nullptr) * 2654435761ull ^
+                 (unsigned long long)(uintptr_t)buf);
+        return string(buf);
+    }();
+    return boundary;
+}
+
+// Send 206 with one range, or a multipart/byteranges body for several
+void send_ranges(Connection& conn, const CachedFile& file, const FileBody& body,
+                 const ByteRange* ranges, int count) {
+    ResponseHead entity;
+    
+    if (count == 1) {
+        uint64_t length = ranges[0].last - ranges[0].first + 1;
+        entity.append("Content-Type: ");
+        entity.append(file.mime_type);
+        entity.append("\r\nContent-Range: bytes ");
+        entity.append_number(ranges[0].first);
+        entity.append("-");
+        entity.append_number(ranges[0].last);
+        entity.append("/");
+        entity.append_number(file.size);
+        entity.append("\r\nContent-Length: ");
+        entity.append_number(length);
+        entity.append("\r\n");
+        if (file.content_encoding != nullptr) {
+            entity.append("Content-Encoding: ");
+            entity.append(file.content_encoding);
+            entity.append("\r\n");
+        }
+        entity.append(file.validator_headers);
+        
+        send_file_headers(conn, 206, entity.view(), file.max_age);
+        queue_body(conn, body, ranges[0].first, length);
+        return;
+    }
+    
+    // Part headers first, so the total length is known
+    const string& boundary = byteranges_boundary();
+    vector<string> part_heads;
+    uint64_t total = 0;
+    
+    for (int i = 0; i < count; ++i) {
+        part_heads.push_back("\r\n--" + boundary + "\r\n" +
+                             "Content-Type: " + file.mime_type + "\r\n" +
+                             "Content-Range: bytes " + to_string(ranges[i].first) + "-" +
+                             to_string(ranges[i].last) + "/" + to_string(file.size) +
+                             "\r\n\r\n");
+        total += part_heads.back().size() + ranges[i].last - ranges[i].first + 1;
+    }
+    string closing = "\r\n--" + boundary + "--\r\n";
+    total += closing.size();
+    
+    entity.append("Content-Type: multipart/byteranges; boundary=");
+    entity.append(boundary);
+    entity.append("\r\nContent-Length: ");
+    entity.append_number(total);
+    entity.append("\r\n");
+    if (file.content_encoding != nullptr) {
+        entity.append("Content-Encoding: ");
+        entity.append(file.content_encoding);
+        entity.append("\r\n");
+    }
+    entity.append(file.validator_headers);
+    
+    send_file_headers(conn, 206, entity.view(), file.max_age);
+    for (int i = 0; i < count; ++i) {
+        queue_output(conn, part_heads[i]);
+        queue_body(conn, body, ranges[i].first, ranges[i].last - ranges[i].first + 1);
+    }
+    queue_output(conn, closing);
+}
+
+// Generate error page
+string generate_error_page(int status_code, const string& message) {
+    stringstream html;
+    
+    html << "<!DOCTYPE html>"
+         << "<html>"
+         << "<head>"
+         << "<title>" << status_code << " " << message << "</title>"
+         << "<style>"
+         << "body { font-family: Arial, sans-serif; text-align: center; padding: 50px; }"
+         << "h1 { color: #333; }"
+         << "p { color: #666; }"
+         << ".container { max-width: 500px; margin: 0 auto; }"
+         << "</style>"
+         << "</head>"
+         << "<body>"
+         << "<div class='container'>"
+         << "<h1>" << status_code << " - " << message << "</h1>"
+         << "<p>Custom HTTP Server</p>"
+         << "</div>"
+         << "</body>"
+         << "</html>";
+    
+    return html.str();
+}
+
+// Handle HTTP request
+void handle_request(Connection& conn, const ParsedRequest& request) {
+    conn.requests_served++;
+    
+    // Keep-alive: default for HTTP/1.1, opt-in for HTTP/1.0
+    string_view connection = request.header(HeaderId::Connection);
+    bool keep_alive = request.version == "HTTP/1.1" ?
+                      !header_has_token(connection, "close") :
+                      header_has_token(connection, "keep-alive");
+    conn.close_after_write = !keep_alive ||
+                             conn.requests_served >= MAX_KEEP_ALIVE_REQUESTS;
+    
+    // Check method; a request body we do not read would break the next request
+    if (request.method != "GET" && request.method != "HEAD") {
+        conn.close_after_write = true;
+        string error_page = generate_error_page(405, "Method Not Allowed");
+        send_response(conn, 405, "text/html", error_page);
+        return;
+    }
+    
+    // Check path safety
+    if (!is_safe_path(request.target)) {
+        string error_page = generate_error_page(403, "Forbidden");
+        send_response(conn, 403, "text/html", error_page);
+        return;
+    }
+    
+    // Normalize path
+    string_view path = request.target;
+    if (path.empty() || path == "/") {
+        path = "index.html";
+    } else if (path[0] == '/') {
+        path.remove_prefix(1);
+    }
+    
+    // URL decode, then check again: %2e%2e and %2f must not escape the root
+    string& filename = conn.path_buffer;
+    url_decode(path, filename);
+    
+    if (!is_safe_path(filename) || filename.empty() || filename[0] == '/') {
+        string error_page = generate_error_page(403, "Forbidden");
+        send_response(conn, 403, "text/html", error_page);
+        return;
+    }
+    
+    // Look up the file (read from disk only on a cache miss)
+    shared_ptr<const CachedFile> file = file_cache.get(filename);
+    
+    if (!file) {
+        string error_page = generate_error_page(404, "Not Found");
+        send_response(conn, 404, "text/html", error_page);
+        return;
+    }
+    
+    // Compressed variant if the client takes one; it has its own validators
+    file = select_variant(file, request.header(HeaderId::AcceptEncoding));
+    
+    if (is_not_modified(request, *file)) {
+        send_file_headers(conn, 304, file->validator_headers, file->max_age);
+        log_message("Not modified: " + filename);
+        return;
+    }
+    
+    // HEAD: everything needed is in the cached metadata; never open the body
+    if (conn.head_request) {
+        send_file_headers(conn, 200, file->entity_headers, file->max_age);
+        log_message("Head: " + filename + " (" + to_string(file->size) + " bytes)");
+        return;
+    }
+    
+    // Range requests
+    ByteRange ranges[MAX_RANGES];
+    int range_count = 0;
+    RangeResult range_result = RangeResult::Ignore;
+    
+    string_view range = request.header(HeaderId::Range);
+    if (!range.empty() && if_range_matches(request, *file)) {
+        range_result = parse_range(range, file->size, ranges, range_count);
+    }
+    
+    if (range_result == RangeResult::Unsatisfiable) {
+        ResponseHead entity;
+        entity.append("Content-Range: bytes */");
+        entity.append_number(file->size);
+        entity.append("\r\nContent-Length: 0\r\n");
+        send_headers(conn, 416, entity.view());
+        log_message("Range not satisfiable: " + filename);
+        return;
+    }
+    
+    // The body is shared with the cache or mapping, or sent from the file;
+    // the chunks hold references, so it is never copied
+    FileBody body;
+    if (!open_file_body(conn, file, body)) {
+        string error_page = generate_error_page(404, "Not Found");
+        send_response(conn, 404, "text/html", error_page);
+        return;
+    }
+    
+    if (range_result == RangeResult::Satisfiable) {
+        send_ranges(conn, *file, body, ranges, range_count);
+        log_message("Served: " + filename + " (" + to_string(range_count) + " ranges)");
+        return;
+    }
+    
+    send_file_headers(conn, 200, file->entity_headers, file->max_age);
+    queue_body(conn, body, 0, file->size);
+    
+    log_message("Served: " + filename + " (" + to_string(file->size) + " bytes)");
+}